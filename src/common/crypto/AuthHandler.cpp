@@ -14,23 +14,22 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "AuthHandler.h"
-#include "Md5Hmac.h"
 
-AuthHandler::AuthHandler(const std::vector<uint8_t>& key) : m_key(key)
+AuthHandler::AuthHandler(const std::vector<uint8_t>& key) : m_key(key), m_hmac(key)
 {
 }
 
-std::vector<uint8_t> AuthHandler::GetICV(const std::vector<uint8_t>& data)
+bool AuthHandler::GetICV(const uint8_t* data, size_t length, uint8_t* icv)
 {
-    return Md5Hmac::ComputeHmac(data, m_key, 10);
+    return m_hmac.Compute(data, length, icv, ICV_SIZE);
 }
 
 bool AuthHandler::VerifyICV(const std::vector<uint8_t>& data)
 {
-    std::vector<uint8_t> storedICV(data.end() - 10, data.end());
+    std::vector<uint8_t> storedICV(data.end() - ICV_SIZE, data.end());
 
-    std::vector<uint8_t> authData(data.begin() + 2, data.end() - 10 - 2);
-    std::vector<uint8_t> expectedICV = Md5Hmac::ComputeHmac(authData, m_key, 10);
+    std::vector<uint8_t> authData(data.begin() + 2, data.end() - ICV_SIZE - 2);
+    std::vector<uint8_t> expectedICV = Md5Hmac::ComputeHmac(authData, m_key, ICV_SIZE);
 
     return storedICV == expectedICV;
 }
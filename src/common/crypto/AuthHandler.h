@@ -16,8 +16,10 @@
 #ifndef GCEMU_AUTHHANDLER_H
 #define GCEMU_AUTHHANDLER_H
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
+#include "Md5Hmac.h"
 
 class AuthHandler
 {
@@ -25,11 +27,15 @@ public:
     AuthHandler() = delete;
     explicit AuthHandler(const std::vector<uint8_t>& key);
 
-    std::vector<uint8_t> GetICV(const std::vector<uint8_t>& data);
+    static constexpr size_t ICV_SIZE = 10;
+
+    // Writes the ICV of data to icv, which must hold ICV_SIZE bytes.
+    bool GetICV(const uint8_t* data, size_t length, uint8_t* icv);
     bool VerifyICV(const std::vector<uint8_t>& data);
 
 private:
     std::vector<uint8_t> m_key {};
+    Md5Hmac m_hmac;
 };
 
 #endif //GCEMU_AUTHHANDLER_H
@@ -20,32 +20,31 @@ CryptoHandler::CryptoHandler(const std::vector<uint8_t> &key) : m_key(key)
 {
 }
 
-std::vector<uint8_t> CryptoHandler::EncryptData(const std::vector<uint8_t>& data, const std::vector<uint8_t>& iv)
+bool CryptoHandler::EncryptData(const uint8_t* data, size_t length, const uint8_t* iv, uint8_t* output)
 {
-    std::vector<uint8_t> paddedData = PadData(data);
-    return DesEncryption::EncryptData(paddedData, iv, m_key);
+    return DesEncryption::EncryptData(data, length, iv, m_key, output);
 }
 
-std::vector<uint8_t> CryptoHandler::DecryptData(const std::vector<uint8_t>& data, const uint8_t* iv)
+bool CryptoHandler::DecryptData(const uint8_t* data, size_t length, const uint8_t* iv, uint8_t* output)
 {
-    return DesEncryption::DecryptData(data, iv, m_key);
+    return DesEncryption::DecryptData(data, length, iv, m_key, output);
 }
 
-std::vector<uint8_t> CryptoHandler::PadData(std::vector<uint8_t> data)
+size_t CryptoHandler::GetPaddedLength(size_t length)
 {
     // Get the distance from the size to the next number divisible by the block size (8).
-    size_t distance = 8 - (data.size() % 8);
+    size_t distance = 8 - (length % 8);
     size_t paddingLength = distance >= 3 ? distance : 8 + distance;
 
-    std::vector<uint8_t> padding(paddingLength);
+    return length + paddingLength;
+}
+
+void CryptoHandler::PadData(uint8_t* data, size_t length, size_t paddedLength)
+{
+    const size_t paddingLength = paddedLength - length;
     for (size_t i = 0; i < paddingLength - 1; i++)
-        padding[i] = i;
+        data[length + i] = i;
 
     // The last byte should be equal to the one before it.
-    padding[paddingLength - 1] = padding[paddingLength - 2];
-
-    // Concat the data with the padding
-    data.insert(data.end(), padding.begin(), padding.end());
-
-    return data;
+    data[paddedLength - 1] = data[paddedLength - 2];
 }
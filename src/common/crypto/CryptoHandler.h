@@ -16,6 +16,7 @@
 #ifndef GCEMU_CRYPTOHANDLER_H
 #define GCEMU_CRYPTOHANDLER_H
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -25,10 +26,15 @@ public:
     CryptoHandler() = delete;
     explicit CryptoHandler(const std::vector<uint8_t>& key);
 
-    std::vector<uint8_t> EncryptData(const std::vector<uint8_t>& data, const std::vector<uint8_t>& iv);
-    std::vector<uint8_t> DecryptData(const std::vector<uint8_t>& data, const uint8_t* iv);
+    // Both work on whole blocks (see PadData), and output may be data itself.
+    bool EncryptData(const uint8_t* data, size_t length, const uint8_t* iv, uint8_t* output);
+    bool DecryptData(const uint8_t* data, size_t length, const uint8_t* iv, uint8_t* output);
 
-    static std::vector<uint8_t> PadData(std::vector<uint8_t> data);
+    // Length of data once padded to whole blocks. The padding is always between 3 and 10 bytes long.
+    static size_t GetPaddedLength(size_t length);
+
+    // Fills data, from length up to paddedLength, with the padding.
+    static void PadData(uint8_t* data, size_t length, size_t paddedLength);
 
 private:
     std::vector<uint8_t> m_key {};
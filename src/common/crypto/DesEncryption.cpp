@@ -14,90 +14,89 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "DesEncryption.h"
+#include <memory>
 #include <openssl/evp.h>
 #include <openssl/err.h>
 #include <spdlog/spdlog.h>
 
-std::vector<uint8_t>
-DesEncryption::EncryptData(const std::vector<uint8_t> &data, const std::vector<uint8_t> &iv, const std::vector<uint8_t> &key)
+bool DesEncryption::EncryptData(const uint8_t* data, size_t length, const uint8_t* iv, const std::vector<uint8_t>& key, uint8_t* output)
 {
-    size_t bufLength = data.size();
-    uint8_t *buf = (uint8_t *) malloc(bufLength);
-
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    EVP_CIPHER_CTX_init(ctx);
+    // Same as for decryption (see below), the thread keeps its context and only re-keys it for every packet.
+    thread_local std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx(nullptr, EVP_CIPHER_CTX_free);
+    if (!ctx)
+    {
+        ctx.reset(EVP_CIPHER_CTX_new());
+        if (!ctx || EVP_EncryptInit_ex(ctx.get(), EVP_des_cbc(), nullptr, nullptr, nullptr) != 1)
+        {
+            spdlog::error("DesEncryption::EncryptData: Error: DES init error!");
+            ctx.reset();
+            return false;
+        }
+
+        EVP_CIPHER_CTX_set_padding(ctx.get(), 0);
+    }
 
-    if (EVP_EncryptInit_ex(ctx, EVP_des_cbc(), nullptr, key.data(), iv.data()) != 1)
+    if (EVP_EncryptInit_ex(ctx.get(), nullptr, nullptr, key.data(), iv) != 1)
     {
         spdlog::error("DesEncryption::EncryptData: Error: DES init error!");
-        return std::vector<uint8_t>();
+        return false;
     }
 
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
-
-    int32_t totalLength = 0;
     int32_t len = 0;
-    if (EVP_EncryptUpdate(ctx, buf, &len, data.data(), (int) data.size()) != 1)
+    if (EVP_EncryptUpdate(ctx.get(), output, &len, data, (int) length) != 1)
     {
         spdlog::error("DesEncryption::EncryptData: Error: Encrypt error!");
-        return std::vector<uint8_t>();
+        return false;
     }
-    totalLength += len;
 
-    if (EVP_EncryptFinal_ex(ctx, buf + len, &len) != 1)
+    int32_t finalLength = 0;
+    if (EVP_EncryptFinal_ex(ctx.get(), output + len, &finalLength) != 1 || (size_t) (len + finalLength) != length)
     {
         spdlog::error("DesEncryption::EncryptData: Error: Encrypt final error!");
-        return std::vector<uint8_t>();
+        return false;
     }
-    totalLength += len;
-
-    EVP_CIPHER_CTX_free(ctx);
-
-    std::vector<uint8_t> encryptedData(totalLength);
-    for (int32_t i = 0; i < totalLength; i++)
-        encryptedData[i] = buf[i];
 
-    return encryptedData;
+    return true;
 }
 
-std::vector<uint8_t>
-DesEncryption::DecryptData(const std::vector<uint8_t> &data, const uint8_t* iv, const std::vector<uint8_t> &key)
+bool DesEncryption::DecryptData(const uint8_t* data, size_t length, const uint8_t* iv, const std::vector<uint8_t>& key, uint8_t* output)
 {
-    size_t bufLength = data.size() + 64 - 1;
-    uint8_t *buf = (uint8_t *) malloc(bufLength);
-
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    EVP_CIPHER_CTX_init(ctx);
+    // Every packet is decrypted with its own key and IV, but the context itself is kept by the thread and only re-keyed,
+    // rather than allocated and set up again for each one.
+    thread_local std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx(nullptr, EVP_CIPHER_CTX_free);
+    if (!ctx)
+    {
+        ctx.reset(EVP_CIPHER_CTX_new());
+        if (!ctx || EVP_DecryptInit_ex(ctx.get(), EVP_des_cbc(), nullptr, nullptr, nullptr) != 1)
+        {
+            spdlog::error("DesEncryption::DecryptData: Error: DES init error!");
+            ctx.reset();
+            return false;
+        }
+
+        EVP_CIPHER_CTX_set_padding(ctx.get(), 0);
+    }
 
-    if (EVP_DecryptInit_ex(ctx, EVP_des_cbc(), nullptr, key.data(), iv) != 1)
+    if (EVP_DecryptInit_ex(ctx.get(), nullptr, nullptr, key.data(), iv) != 1)
     {
         spdlog::error("DesEncryption::DecryptData: Error: DES init error!");
-        return std::vector<uint8_t>();
+        return false;
     }
 
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
-
-    int32_t totalLength = 0;
     int32_t len = 0;
-    if (EVP_DecryptUpdate(ctx, buf, &len, data.data(), (int) data.size()) != 1)
+    if (EVP_DecryptUpdate(ctx.get(), output, &len, data, (int) length) != 1)
     {
         spdlog::error("DesEncryption::DecryptData: Error: Decrypt error!");
-        return std::vector<uint8_t>();
+        return false;
     }
-    totalLength += len;
 
-    if (EVP_DecryptFinal_ex(ctx, buf + len, &len) != 1)
+    // Without padding nothing is held back, so the final step only checks that the data was made of whole blocks.
+    int32_t finalLength = 0;
+    if (EVP_DecryptFinal_ex(ctx.get(), output + len, &finalLength) != 1 || (size_t) (len + finalLength) != length)
     {
         spdlog::error("DesEncryption::DecryptData: Error: Decrypt final error!");
-        return std::vector<uint8_t>();
+        return false;
     }
-    totalLength += len;
-
-    EVP_CIPHER_CTX_free(ctx);
-
-    std::vector<uint8_t> decryptedData(totalLength);
-    for (int32_t i = 0; i < totalLength; i++)
-        decryptedData[i] = buf[i];
 
-    return decryptedData;
+    return true;
 }
@@ -16,14 +16,18 @@
 #ifndef GCEMU_DESENCRYPTION_H
 #define GCEMU_DESENCRYPTION_H
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 class DesEncryption
 {
 public:
-    static std::vector<uint8_t> EncryptData(const std::vector<uint8_t>& data, const std::vector<uint8_t>& iv, const std::vector<uint8_t>& key);
-    static std::vector<uint8_t> DecryptData(const std::vector<uint8_t>& data, const uint8_t* iv, const std::vector<uint8_t>& key);
+    // Encrypts length bytes (a multiple of the block size) into output, which must hold as many and may be data itself.
+    static bool EncryptData(const uint8_t* data, size_t length, const uint8_t* iv, const std::vector<uint8_t>& key, uint8_t* output);
+
+    // Decrypts length bytes (a multiple of the block size) into output, which must hold as many.
+    static bool DecryptData(const uint8_t* data, size_t length, const uint8_t* iv, const std::vector<uint8_t>& key, uint8_t* output);
 };
 
 #endif //GCEMU_DESENCRYPTION_H
@@ -16,7 +16,9 @@
 #ifndef GCEMU_GENERATOR_H
 #define GCEMU_GENERATOR_H
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <random>
@@ -25,52 +27,41 @@
 class Generator
 {
 public:
-    // TODO: keep track of the randomDevice and maybe the generator, as it is costly to create new ones every time.
-
-    static std::vector<uint8_t> GenerateIV(int32_t length = 8)
+    // Writes an IV to iv. Unlike the rest, this runs for every packet sent, so each thread keeps its own generator.
+    static void GenerateIV(uint8_t* iv, size_t length = 8)
     {
-        std::lock_guard<std::mutex> lock(m_generatorMutex);
-
-        std::random_device randomDevice;
-        std::mt19937 rng(randomDevice());
+        thread_local std::mt19937 rng(std::random_device {}());
         std::uniform_int_distribution<uint32_t> uint_dist(0x00, 0xFF);
 
-        std::vector<uint8_t> iv;
-        uint8_t value = (uint8_t) uint_dist(rng);
-        for (int32_t i = 0; i < 8; i++)
-            iv.push_back(value);
-
-        return iv;
+        memset(iv, (uint8_t) uint_dist(rng), length);
     }
 
     static uint16_t GeneratePrefix()
     {
         std::lock_guard<std::mutex> lock(m_generatorMutex);
 
-        std::random_device randomDevice;
-        std::mt19937 rng(randomDevice());
         std::uniform_int_distribution<uint32_t> uint_dist(0x0000, 0xFFFF);
 
-        return (uint16_t) uint_dist(rng);
+        return (uint16_t) uint_dist(m_generator);
     }
 
     static std::vector<uint8_t> GenerateKey(int32_t length = 8)
     {
         std::lock_guard<std::mutex> lock(m_generatorMutex);
 
-        std::random_device randomDevice;
-        std::mt19937 rng(randomDevice());
         std::uniform_int_distribution<uint32_t> uint_dist(0x00, 0xFF);
 
         std::vector<uint8_t> iv;
         for (int32_t i = 0; i < 8; i++)
-            iv.push_back((uint8_t) uint_dist(rng));
+            iv.push_back((uint8_t) uint_dist(m_generator));
 
         return iv;
     }
 
 private:
+    // Seeded once rather than for every call, as creating a random_device is costly.
     inline static std::mutex m_generatorMutex;
+    inline static std::mt19937 m_generator {std::random_device {}()};
 };
 
 #endif //GCEMU_GENERATOR_H
@@ -17,25 +17,59 @@
 #define GCEMU_MD5HMAC_H
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
-#include <iostream>
+#include <cstring>
+#include <memory>
 #include <vector>
-#include <openssl/hmac.h>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
 
+// HMAC-MD5 context keyed once, for computing any number of HMACs under the same key. Not thread-safe.
 class Md5Hmac
 {
 public:
-    static std::vector<uint8_t> ComputeHmac(const std::vector<uint8_t>& data, const std::vector<uint8_t>& hmacKey, int32_t digestSize)
+    explicit Md5Hmac(const std::vector<uint8_t>& hmacKey) : m_context(EVP_MAC_CTX_new(GetMac()), EVP_MAC_CTX_free)
+    {
+        char digestName[] = OSSL_DIGEST_NAME_MD5;
+        const OSSL_PARAM params[] = { OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digestName, 0), OSSL_PARAM_construct_end() };
+        if (m_context && EVP_MAC_init(m_context.get(), hmacKey.data(), hmacKey.size(), params) != 1)
+            m_context.reset();
+    }
+
+    // Writes the first digestSize bytes of the HMAC of data to output.
+    bool Compute(const uint8_t* data, size_t length, uint8_t* output, size_t digestSize)
     {
         assert(digestSize > 0 && digestSize <= 16);
 
-        uint8_t* hmac = HMAC(EVP_md5(), hmacKey.data(), (int) hmacKey.size(), data.data(), data.size(), nullptr, nullptr);
+        // Without a key, init only resets the context to the state it was keyed in.
+        uint8_t hmac[EVP_MAX_MD_SIZE];
+        size_t hmacLength = 0;
+        if (!m_context || EVP_MAC_init(m_context.get(), nullptr, 0, nullptr) != 1 ||
+            EVP_MAC_update(m_context.get(), data, length) != 1 || EVP_MAC_final(m_context.get(), hmac, &hmacLength, sizeof(hmac)) != 1)
+            return false;
+
+        memcpy(output, hmac, digestSize);
+        return true;
+    }
+
+    static std::vector<uint8_t> ComputeHmac(const std::vector<uint8_t>& data, const std::vector<uint8_t>& hmacKey, int32_t digestSize)
+    {
         std::vector<uint8_t> truncatedHmac(digestSize);
-        for (int32_t i = 0; i < digestSize; i++)
-            truncatedHmac[i] = hmac[i];
+        if (!Md5Hmac(hmacKey).Compute(data.data(), data.size(), truncatedHmac.data(), truncatedHmac.size()))
+            return std::vector<uint8_t>();
 
         return truncatedHmac;
     }
+
+private:
+    static EVP_MAC* GetMac()
+    {
+        static std::unique_ptr<EVP_MAC, decltype(&EVP_MAC_free)> mac(EVP_MAC_fetch(nullptr, OSSL_MAC_NAME_HMAC, nullptr), EVP_MAC_free);
+        return mac.get();
+    }
+
+    std::unique_ptr<EVP_MAC_CTX, decltype(&EVP_MAC_CTX_free)> m_context;
 };
 
 #endif //GCEMU_MD5HMAC_H
@@ -29,16 +29,29 @@ std::shared_ptr<SecurityAssociation> Security::CreateNewSecurityAssociation(uint
 {
     std::lock_guard<std::mutex> lock(m_securityMutex);
 
-    std::shared_ptr<SecurityAssociation> sa = std::make_shared<SecurityAssociation>(newSpi);
-
-    if (m_securityAssociationMap.find(newSpi) != m_securityAssociationMap.end())
+    // SPIs are random, so with many connections open a new one may already be taken. Just draw another one.
+    for (int32_t attempt = 0; attempt < SPI_ATTEMPTS; attempt++)
     {
-        spdlog::error("Security Association with specified SPI (0x{0}) already exists!", newSpi);
-        return nullptr;
+        std::shared_ptr<SecurityAssociation> sa = std::make_shared<SecurityAssociation>(newSpi);
+        if (m_securityAssociationMap.find(newSpi) != m_securityAssociationMap.end())
+            continue;
+
+        m_securityAssociationMap.insert(std::pair<uint16_t, std::shared_ptr<SecurityAssociation>>(newSpi, sa));
+        return sa;
     }
 
-    m_securityAssociationMap.insert(std::pair<uint16_t, std::shared_ptr<SecurityAssociation>>(newSpi, sa));
-    return sa;
+    spdlog::error("Could not find a free SPI for a new Security Association.");
+    return nullptr;
+}
+
+void Security::RemoveSecurityAssociation(uint16_t spi)
+{
+    // The default Security Association is shared by every connection.
+    if (spi == 0x0000)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_securityMutex);
+    m_securityAssociationMap.erase(spi);
 }
 
 std::shared_ptr<SecurityAssociation> Security::GetSecurityAssociation(uint16_t spi)
@@ -60,6 +73,12 @@ std::shared_ptr<SecurityAssociation> Security::GetDefaultSecurityAssociation()
     return GetSecurityAssociation(0x0000);
 }
 
+size_t Security::GetSecurityAssociationCount()
+{
+    std::lock_guard<std::mutex> lock(m_securityMutex);
+    return m_securityAssociationMap.size();
+}
+
 bool Security::InitOpenSSL()
 {
     // Starting with OpenSSL 3.0, several deprecated or insecure algorithms were moved into an
@@ -16,6 +16,7 @@
 #ifndef GCEMU_SECURITY_H
 #define GCEMU_SECURITY_H
 
+#include <cstddef>
 #include <cstdint>
 #include <map>
 #include <memory>
@@ -37,12 +38,18 @@ public:
     static bool InitOpenSSL();
 
     std::shared_ptr<SecurityAssociation> CreateNewSecurityAssociation(uint16_t& newSpi);
+    void RemoveSecurityAssociation(uint16_t spi);
     std::shared_ptr<SecurityAssociation> GetSecurityAssociation(uint16_t spi);
     std::shared_ptr<SecurityAssociation> GetDefaultSecurityAssociation();
 
+    // Security Associations in use, the default one included.
+    size_t GetSecurityAssociationCount();
+
 private:
     Security();
 
+    static constexpr int32_t SPI_ATTEMPTS = 8;
+
     std::map<uint16_t, std::shared_ptr<SecurityAssociation>> m_securityAssociationMap;
 
     std::mutex m_securityMutex;
@@ -35,43 +35,33 @@ SecurityAssociation::SecurityAssociation(uint16_t &spi, bool defaultKeys)
     m_cryptoHandler = std::make_shared<CryptoHandler>(m_encryptionKey);
 }
 
-std::vector<uint8_t> SecurityAssociation::GetSecurityAssociationData()
+SecurityAssociationData SecurityAssociation::GetSecurityAssociationData()
 {
     std::lock_guard<std::mutex> lock(m_securityAssociationMutex);
 
-    ByteBuffer buffer;
-
-    buffer << (uint32_t) m_authenticationKey.size();
-    buffer << m_authenticationKey;
-    buffer << (uint32_t) m_encryptionKey.size();
-    buffer << m_encryptionKey;
-    buffer << ++m_sequenceNumber;
-    buffer << m_lastSequenceNumber;
-    buffer << m_replayWindowMask;
-
-    return buffer.GetData();
+    return SecurityAssociationData { m_authenticationKey, m_encryptionKey, ++m_sequenceNumber, m_lastSequenceNumber,
+                                     m_replayWindowMask };
 }
 
-std::vector<uint8_t>
-SecurityAssociation::EncryptData(const std::vector<uint8_t> &data, std::vector<uint8_t> &iv, uint16_t &spi, uint32_t &sequenceNumber)
+bool SecurityAssociation::EncryptData(uint8_t* data, size_t length, uint8_t* iv, uint16_t& spi, uint32_t& sequenceNumber)
 {
     std::lock_guard<std::mutex> lock(m_securityAssociationMutex);
 
-    iv = Generator::GenerateIV();
+    Generator::GenerateIV(iv);
     spi = m_spi;
     sequenceNumber = ++m_sequenceNumber;
-    return m_cryptoHandler->EncryptData(data, iv);
+    return m_cryptoHandler->EncryptData(data, length, iv, data);
 }
 
-std::vector<uint8_t> SecurityAssociation::DecryptData(const std::vector<uint8_t> &data, const uint8_t *iv)
+bool SecurityAssociation::DecryptData(const uint8_t* data, size_t length, const uint8_t* iv, uint8_t* output)
 {
-    return m_cryptoHandler->DecryptData(data, iv);
+    return m_cryptoHandler->DecryptData(data, length, iv, output);
 }
 
-std::vector<uint8_t> SecurityAssociation::GetHmac(const std::vector<uint8_t> &data)
+bool SecurityAssociation::GetHmac(const uint8_t* data, size_t length, uint8_t* icv)
 {
     std::lock_guard<std::mutex> lock(m_securityAssociationMutex);
-    return m_authHandler->GetICV(data);
+    return m_authHandler->GetICV(data, length, icv);
 }
 
 bool SecurityAssociation::IsValidSequenceNumber(uint32_t sequenceNumber) const
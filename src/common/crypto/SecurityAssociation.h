@@ -22,10 +22,27 @@
 #include "AuthHandler.h"
 #include "CryptoHandler.h"
 #include "Generator.h"
-#include "../util/ByteBuffer.h"
+#include <tuple>
+#include <vector>
 
 #define REPLAY_WINDOW_SIZE  32
 
+// What the client is told of a new Security Association (see PacketSchema).
+struct SecurityAssociationData
+{
+    std::vector<uint8_t> AuthenticationKey;
+    std::vector<uint8_t> EncryptionKey;
+    uint32_t SequenceNumber = 0;
+    uint32_t LastSequenceNumber = 0;
+    uint32_t ReplayWindowMask = 0;
+
+    static constexpr auto Fields = std::make_tuple(&SecurityAssociationData::AuthenticationKey,
+                                                   &SecurityAssociationData::EncryptionKey,
+                                                   &SecurityAssociationData::SequenceNumber,
+                                                   &SecurityAssociationData::LastSequenceNumber,
+                                                   &SecurityAssociationData::ReplayWindowMask);
+};
+
 class SecurityAssociation
 {
 public:
@@ -33,11 +50,14 @@ public:
 
     explicit SecurityAssociation(uint16_t& spi, bool defaultKeys = false);
 
-    std::vector<uint8_t> GetSecurityAssociationData();
+    SecurityAssociationData GetSecurityAssociationData();
+
+    // Encrypts length bytes of padded data (see CryptoHandler::PadData) in place, under a new IV written to iv.
+    bool EncryptData(uint8_t* data, size_t length, uint8_t* iv, uint16_t& spi, uint32_t& sequenceNumber);
+    bool DecryptData(const uint8_t* data, size_t length, const uint8_t* iv, uint8_t* output);
 
-    std::vector<uint8_t> EncryptData(const std::vector<uint8_t>& data, std::vector<uint8_t>& iv, uint16_t& spi, uint32_t& sequenceNumber);
-    std::vector<uint8_t> DecryptData(const std::vector<uint8_t>& data, const uint8_t* iv);
-    std::vector<uint8_t> GetHmac(const std::vector<uint8_t>& data);
+    // Writes the ICV of data to icv (see AuthHandler::ICV_SIZE).
+    bool GetHmac(const uint8_t* data, size_t length, uint8_t* icv);
     bool IsValidSequenceNumber(uint32_t sequenceNumber) const;
 
 private:
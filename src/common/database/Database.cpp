@@ -14,9 +14,20 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "Database.h"
+#include "../util/ThreadAffinity.h"
+#include <cstdarg>
 #include <cstdio>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_awaitable.hpp>
 #include <spdlog/spdlog.h>
 
+namespace
+{
+    // Index of the query thread running on this thread, and of the connection it uses.
+    thread_local size_t t_queryThreadIndex = 0;
+}
+
 size_t Database::m_databaseCount = 0;
 
 Database::Database()
@@ -51,6 +62,53 @@ bool Database::Initialize(const std::string& info, uint32_t numConnections)
     return true;
 }
 
+void Database::StartQueryThreads()
+{
+    std::lock_guard<std::mutex> lock(m_queryThreadsLock);
+    if (!m_queryThreads.empty() || m_queryConnections.empty())
+        return;
+
+    m_queryContext.restart();
+    m_queryWork = std::make_unique<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>(m_queryContext.get_executor());
+
+    for (size_t i = 0; i < m_queryConnections.size(); i++)
+    {
+        m_queryThreads.emplace_back([this, i] ()
+        {
+            SThreadAffinity.Apply(ThreadAffinity::ThreadRole::Database, i);
+            t_queryThreadIndex = i;
+            m_queryContext.run();
+        });
+    }
+
+    spdlog::info("Database::StartQueryThreads: {0} query threads started.", m_queryThreads.size());
+}
+
+void Database::StopQueryThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_queryThreadsLock);
+        m_queryWork.reset();
+    }
+
+    // The threads leave once the queue is empty.
+    for (std::thread& thread : m_queryThreads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+
+    m_queryThreads.clear();
+}
+
+void Database::Shutdown()
+{
+    StopQueryThreads();
+
+    m_queryConnections.clear();
+    m_asyncConnection.reset();
+}
+
 bool Database::Execute(const std::string& sql)
 {
     if (!m_asyncConnection)
@@ -96,5 +154,59 @@ std::unique_ptr<QueryResult> Database::PreparedQuery(const char* format, ...)
         return {};
     }
 
-    return m_queryConnections[0]->Query(szQuery);
+    if (m_queryConnections.empty())
+        return {};
+
+    const uint32_t index = m_nextQueryConnection.fetch_add(1, std::memory_order_relaxed) % m_queryConnections.size();
+    return m_queryConnections[index]->Query(szQuery);
+}
+
+boost::asio::awaitable<QueryOutcome> Database::AsyncQuery(std::string sql)
+{
+    auto initiation = [this] (auto handler, std::string sql)
+    {
+        std::lock_guard<std::mutex> lock(m_queryThreadsLock);
+        if (!m_queryWork)
+        {
+            const auto executor = boost::asio::get_associated_executor(handler);
+            boost::asio::post(executor, [handler = std::move(handler)] () mutable { handler(QueryOutcome()); });
+            return;
+        }
+
+        boost::asio::post(m_queryContext, [this, handler = std::move(handler), sql = std::move(sql)] () mutable
+        {
+            QueryOutcome outcome;
+            outcome.Succeeded = m_queryConnections[t_queryThreadIndex]->Query(sql, outcome.Result);
+
+            const auto executor = boost::asio::get_associated_executor(handler);
+            boost::asio::post(executor, [handler = std::move(handler), outcome = std::move(outcome)] () mutable
+            {
+                handler(std::move(outcome));
+            });
+        });
+    };
+
+    return boost::asio::async_initiate<const boost::asio::use_awaitable_t<>, void(QueryOutcome)>(
+        std::move(initiation), boost::asio::use_awaitable, std::move(sql));
+}
+
+boost::asio::awaitable<QueryOutcome> Database::AsyncPreparedQuery(const char* format, ...)
+{
+    // Not a coroutine itself: the query is formatted right away, while the arguments are still there.
+    if (!format)
+        return AsyncQuery(std::string());
+
+    va_list ap;
+    char szQuery [32 * 1024];
+    va_start(ap, format);
+    int res = vsnprintf(szQuery, 32 * 1024, format, ap);
+    va_end(ap);
+
+    if (res == -1)
+    {
+        spdlog::error("SQL Query truncated (and not execute) for format: {0}", format);
+        return AsyncQuery(std::string());
+    }
+
+    return AsyncQuery(szQuery);
 }
@@ -18,14 +18,29 @@
 
 #include "MySqlConnection.h"
 #include "SqlOperations.h"
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
 #include <boost/thread/tss.hpp>
 
 #define QUERY_CONNECTION_POOL_MIN_SIZE 1
 #define QUERY_CONNECTION_POOL_MAX_SIZE 16
 
+// Outcome of an asynchronous query.
+struct QueryOutcome
+{
+    // Whether the query could be run at all. One that ran but matched no rows succeeds without a result.
+    bool Succeeded = false;
+    std::unique_ptr<QueryResult> Result;
+};
+
 class Database
 {
 public:
@@ -33,16 +48,42 @@ public:
 
     bool Initialize(const std::string& info, uint32_t numConnections = 1);
 
+    // Closes every connection. Nothing may use the database afterwards.
+    void Shutdown();
+
+    // Starts the query threads, one per query connection, which run the asynchronous queries. Stopping them waits for
+    // the queries already queued, whose results still go to their coroutines; later queries complete right away
+    // without a result.
+    void StartQueryThreads();
+    void StopQueryThreads();
+
     bool Execute(const std::string& sql);
     bool PreparedExecute(const char* format, ...);
     std::unique_ptr<QueryResult> PreparedQuery(const char* format, ...);
 
+    // Runs the query on a query thread while the awaiting coroutine is suspended, and resumes it on its own executor
+    // with the outcome, so the network thread it runs on is free in the meantime. A query that can't be run, because
+    // the query threads are stopped or the database failed it, doesn't succeed.
+    boost::asio::awaitable<QueryOutcome> AsyncQuery(std::string sql);
+    boost::asio::awaitable<QueryOutcome> AsyncPreparedQuery(const char* format, ...);
+
 private:
     std::vector<std::shared_ptr<MySqlConnection>> m_queryConnections;
     uint32_t m_queryConnectionPoolSize = 1;
 
+    // Queries may come from several logic workers at once, and are spread over the pool.
+    std::atomic<uint32_t> m_nextQueryConnection {0};
+
     std::shared_ptr<MySqlConnection> m_asyncConnection;
 
+    // Each query thread sticks to the query connection of the same index.
+    boost::asio::io_context m_queryContext;
+    std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> m_queryWork;
+    std::vector<std::thread> m_queryThreads;
+
+    // Guards m_queryWork, so no query is queued once the threads may have left.
+    std::mutex m_queryThreadsLock;
+
     boost::thread_specific_ptr<SqlTransaction> m_currentTransaction;
 
     static size_t m_databaseCount;
@@ -17,6 +17,12 @@
 #include "../util/StringUtil.h"
 #include <spdlog/spdlog.h>
 
+MySqlConnection::~MySqlConnection()
+{
+    if (m_mySql)
+        mysql_close(m_mySql);
+}
+
 bool MySqlConnection::Initialize(const std::string &connectionInfo)
 {
     MYSQL* mySqlInit = mysql_init(nullptr);
@@ -85,6 +91,7 @@ bool MySqlConnection::Execute(const std::string &sql)
     if (!m_mySql)
         return false;
 
+    std::lock_guard<std::mutex> lock(m_lock);
     if (mysql_query(m_mySql, sql.c_str()))
     {
         spdlog::error("SQL: {0}", sql);
@@ -99,22 +106,33 @@ bool MySqlConnection::Execute(const std::string &sql)
 
 std::unique_ptr<QueryResult> MySqlConnection::Query(const std::string &sql)
 {
-    MYSQL_RES* result = nullptr;
+    std::unique_ptr<QueryResult> result;
+    Query(sql, result);
+    return result;
+}
+
+bool MySqlConnection::Query(const std::string &sql, std::unique_ptr<QueryResult>& result)
+{
+    MYSQL_RES* mySqlResult = nullptr;
     MYSQL_FIELD* fields = nullptr;
     uint64_t rowCount = 0;
     uint32_t fieldCount = 0;
 
-    if (!ProcessQuery(sql, &result, &fields, &rowCount, &fieldCount))
-        return nullptr;
+    result.reset();
+    if (!ProcessQuery(sql, &mySqlResult, &fields, &rowCount, &fieldCount))
+        return false;
 
-    auto queryResult = std::make_unique<QueryResult>(result, fields, rowCount, fieldCount);
+    if (!mySqlResult)
+        return true;
 
-    queryResult->NextRow();
-    return queryResult;
+    result = std::make_unique<QueryResult>(mySqlResult, fields, rowCount, fieldCount);
+    result->NextRow();
+    return true;
 }
 
 bool MySqlConnection::TransactionCommand(const std::string &sql)
 {
+    std::lock_guard<std::mutex> lock(m_lock);
     if (mysql_query(m_mySql, sql.c_str()))
     {
         spdlog::error("SQL: {0}", sql);
@@ -132,6 +150,8 @@ MySqlConnection::ProcessQuery(const std::string &sql, MYSQL_RES **pResult, MYSQL
     if (!m_mySql)
         return false;
 
+    // The result is stored client side, so it can be read after the connection is handed to someone else.
+    std::lock_guard<std::mutex> lock(m_lock);
     if (mysql_query(m_mySql, sql.c_str()))
     {
         spdlog::error("SQL: {0}", sql);
@@ -143,13 +163,22 @@ MySqlConnection::ProcessQuery(const std::string &sql, MYSQL_RES **pResult, MYSQL
     *pRowCount = mysql_affected_rows(m_mySql);
     *pFieldCount = mysql_field_count(m_mySql);
 
+    // Without a result set, the statement either returns no columns at all or failed while the rows were read.
     if (!*pResult)
+    {
+        if (!*pFieldCount)
+            return true;
+
+        spdlog::error("SQL: {0}", sql);
+        spdlog::error("query ERROR: {0}", mysql_error(m_mySql));
         return false;
+    }
 
     if (!*pRowCount)
     {
         mysql_free_result(*pResult);
-        return false;
+        *pResult = nullptr;
+        return true;
     }
 
     *pFields = mysql_fetch_fields(*pResult);
@@ -18,12 +18,16 @@
 
 #include "QueryResult.h"
 #include <memory>
+#include <mutex>
 #include <string>
 #include <mysql/mysql.h>
 
+// A single MySQL connection. Statements may be issued from any thread, one at a time.
 class MySqlConnection
 {
 public:
+    ~MySqlConnection();
+
     bool Initialize(const std::string& connectionInfo);
 
     bool BeginTransaction();
@@ -31,13 +35,20 @@ public:
     bool RollbackTransaction();
 
     bool Execute(const std::string& sql);
+
+    // Returns nothing both when the query fails and when it matches no rows.
     std::unique_ptr<QueryResult> Query(const std::string& sql);
 
+    // Tells the two apart: returns false only when the query couldn't be run, and leaves the result empty when it
+    // matched no rows.
+    bool Query(const std::string& sql, std::unique_ptr<QueryResult>& result);
+
 private:
     bool TransactionCommand(const std::string& sql);
     bool ProcessQuery(const std::string &sql, MYSQL_RES **pResult, MYSQL_FIELD **pFields, uint64_t *pRowCount, uint32_t *pFieldCount);
 
-    MYSQL* m_mySql;
+    MYSQL* m_mySql = nullptr;
+    std::mutex m_lock;
 };
 
 #endif //GCEMU_MYSQLCONNECTION_H
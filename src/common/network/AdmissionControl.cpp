@@ -0,0 +1,189 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "AdmissionControl.h"
+#include "NetworkConfig.h"
+#include "NetworkStats.h"
+#include <algorithm>
+
+void AdmissionControl::Initialize()
+{
+    m_maxConnections = SNetworkConfig.GetMaxConnectionsPerIp();
+
+    const uint32_t rate = SNetworkConfig.GetAcceptRatePerIp();
+    m_emissionInterval = rate ? 1000000 / rate : 0;
+    m_burstTolerance = m_emissionInterval * (std::max<uint32_t>(SNetworkConfig.GetAcceptBurstPerIp(), 1) - 1);
+
+    if (!m_maxConnections && !m_emissionInterval)
+    {
+        m_entries.reset();
+        m_mask = 0;
+        return;
+    }
+
+    m_entries = std::make_unique<Entry[]>(SNetworkConfig.GetAdmissionTableSize());
+    m_mask = SNetworkConfig.GetAdmissionTableSize() - 1;
+}
+
+bool AdmissionControl::Admit(const boost::asio::ip::address& address, int32_t& slot)
+{
+    slot = INVALID_SLOT;
+    if (!m_entries)
+        return true;
+
+    const uint32_t key = MakeKey(address);
+    const uint64_t now = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+
+    // Knuth's multiplicative hash, so neighbouring addresses don't all end up in the same cluster.
+    const size_t home = (size_t) ((key * 2654435761u) & m_mask);
+
+    // Only retried when another thread changes an entry we were about to use.
+    for (int32_t attempt = 0; attempt < 4; attempt++)
+    {
+        size_t index = m_mask + 1;
+        size_t candidate = m_mask + 1;
+        uint64_t candidateState = 0;
+
+        for (size_t probe = 0; probe < MAX_PROBES && probe <= m_mask; probe++)
+        {
+            const size_t current = (home + probe) & m_mask;
+            const uint64_t state = m_entries[current].State.load(std::memory_order_acquire);
+            if ((uint32_t) (state >> 32) == key)
+            {
+                index = current;
+                break;
+            }
+
+            // Entries are never freed, only reused, so nothing past a free entry can hold the key.
+            if (state == 0)
+            {
+                if (candidate > m_mask)
+                {
+                    candidate = current;
+                    candidateState = state;
+                }
+
+                break;
+            }
+
+            // An idle entry whose limiter has fully recovered holds nothing worth keeping.
+            if (candidate > m_mask && (uint32_t) state == 0 && m_entries[current].NextArrival.load(std::memory_order_relaxed) <= now)
+            {
+                candidate = current;
+                candidateState = state;
+            }
+        }
+
+        if (index > m_mask)
+        {
+            if (candidate > m_mask)
+            {
+                // Rejecting here would let a flood from many sources lock everyone else out, so let it through.
+                NetworkStats::Increment(SNetworkStats.AdmissionTableFull);
+                return true;
+            }
+
+            if (!m_entries[candidate].State.compare_exchange_strong(candidateState, (uint64_t) key << 32, std::memory_order_acq_rel))
+                continue;
+
+            index = candidate;
+        }
+
+        Entry& entry = m_entries[index];
+
+        // The cap is checked first, holding a connection of the entry meanwhile, so that only the connections that are
+        // let in use up the rate limit.
+        bool held = false;
+        uint64_t state = entry.State.load(std::memory_order_acquire);
+        while ((uint32_t) (state >> 32) == key)
+        {
+            if (m_maxConnections && (uint32_t) state >= m_maxConnections)
+            {
+                NetworkStats::Increment(SNetworkStats.AdmissionRejectedByCap);
+                return false;
+            }
+
+            if (entry.State.compare_exchange_weak(state, state + 1, std::memory_order_acq_rel))
+            {
+                held = true;
+                break;
+            }
+        }
+
+        if (held)
+        {
+            if (!CheckRate(entry, now))
+            {
+                entry.State.fetch_sub(1, std::memory_order_acq_rel);
+                NetworkStats::Increment(SNetworkStats.AdmissionRejectedByRate);
+                return false;
+            }
+
+            slot = (int32_t) index;
+            return true;
+        }
+
+        // The entry went to another source in the meantime, look again.
+    }
+
+    NetworkStats::Increment(SNetworkStats.AdmissionTableFull);
+    return true;
+}
+
+void AdmissionControl::Release(int32_t slot)
+{
+    if (slot == INVALID_SLOT || !m_entries)
+        return;
+
+    // An entry with live connections is never reused, so the key can't have changed.
+    m_entries[slot].State.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+uint32_t AdmissionControl::MakeKey(const boost::asio::ip::address& address)
+{
+    uint32_t key;
+    if (address.is_v4())
+        key = address.to_v4().to_uint();
+    else if (address.to_v6().is_v4_mapped())
+        key = address.to_v6().to_v4().to_uint();
+    else
+    {
+        // FNV-1a over the /64 prefix.
+        const boost::asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+        key = 2166136261u;
+        for (size_t i = 0; i < 8; i++)
+            key = (key ^ bytes[i]) * 16777619u;
+    }
+
+    // 0 marks a free entry.
+    return key ? key : 1;
+}
+
+bool AdmissionControl::CheckRate(Entry& entry, uint64_t now)
+{
+    if (!m_emissionInterval)
+        return true;
+
+    uint64_t nextArrival = entry.NextArrival.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        const uint64_t arrival = std::max(nextArrival, now);
+        if (arrival - now > m_burstTolerance)
+            return false;
+
+        if (entry.NextArrival.compare_exchange_weak(nextArrival, arrival + m_emissionInterval, std::memory_order_relaxed))
+            return true;
+    }
+}
@@ -0,0 +1,85 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_ADMISSIONCONTROL_H
+#define GCEMU_ADMISSIONCONTROL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <boost/asio/ip/address.hpp>
+
+#define SAdmissionControl AdmissionControl::GetInstance()
+
+// Per-source limits checked right after accept, before a connection costs anything (security association, handshake).
+// Each source address gets an entry in a fixed-size, lock-free open addressing table, holding its number of live
+// connections and a rate limiter (GCRA, which behaves like a token bucket stored in a single word). IPv6 sources are
+// grouped by /64 prefix, as a single host usually owns the whole prefix.
+//
+// The accounting is approximate by design: sources hashing to the same key share an entry, and an entry with no live
+// connections whose rate limit has fully recovered may be handed to another source when the table is crowded.
+class AdmissionControl
+{
+public:
+    static constexpr int32_t INVALID_SLOT = -1;
+
+    static AdmissionControl& GetInstance()
+    {
+        static AdmissionControl instance;
+        return instance;
+    }
+
+    AdmissionControl(AdmissionControl const&) = delete;
+    void operator=(AdmissionControl const&) = delete;
+
+    // Sizes the table from the config. Must be called once, before any connection is accepted.
+    void Initialize();
+
+    // Returns whether a new connection from the address may be opened. On success, slot is set to the entry that has
+    // to be handed back to Release() once the connection closes. Safe to call from any thread.
+    bool Admit(const boost::asio::ip::address& address, int32_t& slot);
+    void Release(int32_t slot);
+
+private:
+    AdmissionControl() {}
+
+    struct Entry
+    {
+        // Source key in the upper 32 bits, live connections in the lower ones, so claiming an entry and counting a
+        // connection on it are one atomic operation. A key of 0 marks a free entry.
+        std::atomic<uint64_t> State {0};
+
+        // Theoretical arrival time of the next connection, in microseconds since m_start.
+        std::atomic<uint64_t> NextArrival {0};
+    };
+
+    static uint32_t MakeKey(const boost::asio::ip::address& address);
+    bool CheckRate(Entry& entry, uint64_t now);
+
+    // Entries looked at before giving up on finding one for a source.
+    static constexpr size_t MAX_PROBES = 16;
+
+    std::unique_ptr<Entry[]> m_entries;
+    size_t m_mask = 0;
+
+    uint32_t m_maxConnections = 0;
+    uint64_t m_emissionInterval = 0;
+    uint64_t m_burstTolerance = 0;
+
+    const std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+};
+
+#endif //GCEMU_ADMISSIONCONTROL_H
@@ -0,0 +1,104 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "BufferPool.h"
+#include <algorithm>
+#include <cassert>
+
+BufferPool::BufferPool()
+{
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; i++)
+        m_pools[i] = std::make_unique<MemoryPool>(MIN_BLOCK_SIZE << i);
+}
+
+uint8_t* BufferPool::Allocate(size_t size)
+{
+    if (MemoryPool* pool = GetPool(size))
+        return static_cast<uint8_t*>(pool->Allocate());
+
+    return static_cast<uint8_t*>(::operator new(size));
+}
+
+void BufferPool::Deallocate(uint8_t* buffer, size_t size)
+{
+    if (MemoryPool* pool = GetPool(size))
+        pool->Deallocate(buffer);
+    else
+        ::operator delete(buffer);
+}
+
+void BufferPool::Reserve(size_t size, size_t count)
+{
+    if (MemoryPool* pool = GetPool(size))
+        pool->Reserve(count);
+}
+
+void BufferPool::Trim(size_t maxFreeBytes)
+{
+    size_t budget = maxFreeBytes;
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; i++)
+    {
+        MemoryPool& pool = *m_pools[i];
+
+        uint64_t hits, misses;
+        size_t freeBlocks;
+        pool.GetStats(hits, misses, freeBlocks);
+
+        // Smaller buffers are the ones every connection starts with, so they get the budget first.
+        const size_t keepBlocks = std::min(freeBlocks, budget / pool.GetBlockSize());
+        budget -= keepBlocks * pool.GetBlockSize();
+
+        if (keepBlocks < freeBlocks)
+            pool.Trim(keepBlocks);
+    }
+}
+
+void BufferPool::GetStats(uint64_t& hits, uint64_t& misses, size_t& freeBytes)
+{
+    hits = misses = freeBytes = 0;
+    for (auto& pool : m_pools)
+    {
+        uint64_t poolHits, poolMisses;
+        size_t poolFreeBlocks;
+        pool->GetStats(poolHits, poolMisses, poolFreeBlocks);
+
+        hits += poolHits;
+        misses += poolMisses;
+        freeBytes += poolFreeBlocks * pool->GetBlockSize();
+    }
+}
+
+size_t BufferPool::GetUsedBuffers()
+{
+    size_t usedBuffers = 0;
+    for (auto& pool : m_pools)
+        usedBuffers += pool->GetUsedBlocks();
+
+    return usedBuffers;
+}
+
+MemoryPool* BufferPool::GetPool(size_t size)
+{
+    assert((size & (size - 1)) == 0);
+
+    if (size < MIN_BLOCK_SIZE || size > MAX_BLOCK_SIZE)
+        return nullptr;
+
+    size_t index = 0;
+    while ((MIN_BLOCK_SIZE << index) < size)
+        index++;
+
+    return m_pools[index].get();
+}
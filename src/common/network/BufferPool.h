@@ -0,0 +1,56 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_BUFFERPOOL_H
+#define GCEMU_BUFFERPOOL_H
+
+#include "../util/MemoryPool.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Pools of power-of-two sized buffers, used for the socket receive buffers. Sizes outside of the pooled range are
+// served straight from the heap.
+class BufferPool
+{
+public:
+    static constexpr size_t MIN_BLOCK_SIZE = 512;
+    static constexpr size_t MAX_BLOCK_SIZE = 65536;
+
+    BufferPool();
+
+    uint8_t* Allocate(size_t size);
+    void Deallocate(uint8_t* buffer, size_t size);
+
+    void Reserve(size_t size, size_t count);
+
+    // Releases free buffers, largest first, until no more than maxFreeBytes are kept around.
+    void Trim(size_t maxFreeBytes);
+
+    void GetStats(uint64_t& hits, uint64_t& misses, size_t& freeBytes);
+
+    // Pooled buffers handed out and not released yet.
+    size_t GetUsedBuffers();
+
+private:
+    static constexpr size_t SIZE_CLASS_COUNT = 8; // 512 bytes up to 64 KB
+
+    MemoryPool* GetPool(size_t size);
+
+    std::array<std::unique_ptr<MemoryPool>, SIZE_CLASS_COUNT> m_pools;
+};
+
+#endif //GCEMU_BUFFERPOOL_H
@@ -0,0 +1,61 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "FrameDecoder.h"
+
+FrameDecoder::FrameDecoder(size_t maxFrameSize) : m_maxFrameSize(maxFrameSize)
+{
+}
+
+FrameDecoder::Result FrameDecoder::Next(PacketBuffer& buffer, std::vector<uint8_t>& scratch, const uint8_t*& frame, size_t& length)
+{
+    if (m_state == State::NeedHeader)
+    {
+        if (buffer.ReadLengthRemaining() < HEADER_SIZE)
+            return Result::NeedMoreData;
+
+        m_frameSize = buffer.Peek(0) | (buffer.Peek(1) << 8);
+        if (m_frameSize < HEADER_SIZE || m_frameSize > m_maxFrameSize)
+            return Result::Invalid;
+
+        m_state = State::NeedBody;
+    }
+
+    if (buffer.ReadLengthRemaining() < m_frameSize)
+        return Result::NeedMoreData;
+
+    // Consuming the frame doesn't touch its bytes, they are only overwritten by the next write to the buffer.
+    frame = buffer.GetReadView(m_frameSize, scratch);
+    length = m_frameSize;
+    buffer.Read(nullptr, m_frameSize);
+
+    m_state = State::NeedHeader;
+    return Result::Frame;
+}
+
+FrameDecoder::State FrameDecoder::GetState() const
+{
+    return m_state;
+}
+
+size_t FrameDecoder::GetFrameSize() const
+{
+    return m_frameSize;
+}
+
+size_t FrameDecoder::GetMaxFrameSize() const
+{
+    return m_maxFrameSize;
+}
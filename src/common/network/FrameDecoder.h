@@ -0,0 +1,69 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_FRAMEDECODER_H
+#define GCEMU_FRAMEDECODER_H
+
+#include "PacketBuffer.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Splits the received byte stream into frames. Every frame starts with its total size, header included, as a 16-bit
+// little-endian integer. The decoder is incremental: the header of a frame is read once, as soon as it is complete,
+// and the decoder then waits in NeedBody until the rest of the frame has been received, however many reads that
+// takes, without looking at the data again. A read holding several frames is handled one Next call per frame.
+class FrameDecoder
+{
+public:
+    static constexpr size_t HEADER_SIZE = 2;
+
+    enum class State : uint8_t
+    {
+        NeedHeader,
+        NeedBody
+    };
+
+    enum class Result : uint8_t
+    {
+        // A whole frame was taken out of the buffer.
+        Frame,
+        // Whatever is left in the buffer is the start of a frame; it stays there until the rest arrives.
+        NeedMoreData,
+        // The size in the header is smaller than the header or larger than the maximum frame size. The stream can't
+        // be resynchronized after that, so the connection has to go.
+        Invalid
+    };
+
+    explicit FrameDecoder(size_t maxFrameSize);
+
+    // Takes the next frame out of the buffer. On Result::Frame, frame points to its length bytes, header included,
+    // which stay valid until more data is written to the buffer. They are only copied (into scratch) when the frame
+    // wraps around the end of the ring buffer.
+    Result Next(PacketBuffer& buffer, std::vector<uint8_t>& scratch, const uint8_t*& frame, size_t& length);
+
+    State GetState() const;
+
+    // Size of the frame being waited for in NeedBody, or of the one rejected as Invalid.
+    size_t GetFrameSize() const;
+    size_t GetMaxFrameSize() const;
+
+private:
+    size_t m_maxFrameSize;
+    State m_state = State::NeedHeader;
+    size_t m_frameSize = 0;
+};
+
+#endif //GCEMU_FRAMEDECODER_H
@@ -0,0 +1,112 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "NetworkConfig.h"
+#include "FrameDecoder.h"
+#include "PacketBuffer.h"
+#include "../config/ConfigHandler.h"
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <spdlog/spdlog.h>
+
+bool NetworkConfig::Load()
+{
+    m_corkEnabled = SConfigHandler.GetBool("network_cork", false);
+    m_corkMaxDelay = std::chrono::milliseconds(std::max(SConfigHandler.GetInt("network_cork_max_delay_ms", 0), 0));
+    m_corkMaxBytes = (size_t) std::max(SConfigHandler.GetInt("network_cork_max_bytes", 16384), 1);
+
+    m_reusePortEnabled = SConfigHandler.GetBool("network_reuse_port", false);
+
+    m_poolPrewarm = (size_t) std::max(SConfigHandler.GetInt("network_pool_prewarm", 0), 0);
+
+    // Rounded up to a power of two and kept within the sizes the buffer pools serve.
+    auto bufferSize = [] (int value)
+    {
+        size_t size = BufferPool::MIN_BLOCK_SIZE;
+        while (size < (size_t) value && size < BufferPool::MAX_BLOCK_SIZE)
+            size <<= 1;
+
+        return size;
+    };
+
+    m_receiveBufferInitialSize = bufferSize(SConfigHandler.GetInt("network_receive_buffer_initial", DEFAULT_BUFFER_SIZE));
+    m_receiveBufferMaxSize = std::max(bufferSize(SConfigHandler.GetInt("network_receive_buffer_max", 65536)),
+                                      m_receiveBufferInitialSize);
+    m_maxFrameSize = std::min((size_t) std::max(SConfigHandler.GetInt("network_max_frame_size", 16384), 0),
+                              std::min(m_receiveBufferMaxSize, (size_t) UINT16_MAX));
+    if (m_maxFrameSize < FrameDecoder::HEADER_SIZE)
+    {
+        spdlog::error("NetworkConfig::Load: network_max_frame_size must be at least {0}.", FrameDecoder::HEADER_SIZE);
+        return false;
+    }
+
+    m_bufferIdleTimeout = std::chrono::milliseconds(std::max(SConfigHandler.GetInt("network_buffer_idle_timeout_ms", 10000), 0));
+    m_sweepInterval = std::chrono::milliseconds(std::max(SConfigHandler.GetInt("network_sweep_interval_ms", 1000), 1));
+    m_poolMaxFreeBytes = (size_t) std::max(SConfigHandler.GetInt("network_pool_max_free_bytes", 4 * 1024 * 1024), 0);
+
+    m_maxConnectionsPerIp = (uint32_t) std::max(SConfigHandler.GetInt("network_max_connections_per_ip", 32), 0);
+    m_acceptRatePerIp = (uint32_t) std::max(SConfigHandler.GetInt("network_accept_rate_per_ip", 10), 0);
+    m_acceptBurstPerIp = (uint32_t) std::max(SConfigHandler.GetInt("network_accept_burst_per_ip", 20), 1);
+
+    m_admissionTableSize = (size_t) std::max(SConfigHandler.GetInt("network_admission_table_size", 65536), 1);
+    if (m_admissionTableSize & (m_admissionTableSize - 1))
+    {
+        spdlog::error("NetworkConfig::Load: network_admission_table_size must be a power of two.");
+        return false;
+    }
+
+    m_migrationThreshold = (uint32_t) std::max(SConfigHandler.GetInt("network_migration_threshold", 0), 0);
+    m_migrationBatch = (size_t) std::max(SConfigHandler.GetInt("network_migration_batch", 16), 1);
+
+    m_statsInterval = std::chrono::seconds(std::max(SConfigHandler.GetInt("network_stats_interval", 0), 0));
+
+    m_timerResolution = std::chrono::milliseconds(std::max(SConfigHandler.GetInt("network_timer_resolution_ms", 100), 1));
+    m_idleTimeout = std::chrono::milliseconds(std::max(SConfigHandler.GetInt("network_idle_timeout_ms", 300000), 0));
+    m_handshakeTimeout = std::chrono::milliseconds(std::max(SConfigHandler.GetInt("network_handshake_timeout_ms", 30000), 0));
+    m_heartbeatTimeout = std::chrono::milliseconds(std::max(SConfigHandler.GetInt("network_heartbeat_timeout_ms", 60000), 0));
+
+    m_sendQueueHighWatermark = (size_t) std::max(SConfigHandler.GetInt("network_send_queue_high_watermark", 262144), 1);
+    m_sendQueueLowWatermark = std::min((size_t) std::max(SConfigHandler.GetInt("network_send_queue_low_watermark", 65536), 0),
+                                       m_sendQueueHighWatermark);
+    m_sendQueueMaxBytes = std::max((size_t) std::max(SConfigHandler.GetInt("network_send_queue_max_bytes", 1048576), 0),
+                                   m_sendQueueHighWatermark);
+
+    const std::string overflowPolicy = SConfigHandler.GetString("network_send_queue_overflow", "disconnect");
+    if (overflowPolicy == "disconnect")
+        m_sendQueueOverflowPolicy = SendQueueOverflowPolicy::Disconnect;
+    else if (overflowPolicy == "drop")
+        m_sendQueueOverflowPolicy = SendQueueOverflowPolicy::DropNonCritical;
+    else
+    {
+        spdlog::error("NetworkConfig::Load: unknown send queue overflow policy {0}, expected disconnect or drop.",
+                      overflowPolicy);
+        return false;
+    }
+
+    return true;
+}
+
+const char* NetworkConfig::GetIoEngine()
+{
+#if defined(BOOST_ASIO_HAS_IOCP)
+    return "iocp";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+    return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+    return "kqueue";
+#else
+    return "select";
+#endif
+}
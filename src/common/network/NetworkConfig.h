@@ -0,0 +1,145 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_NETWORKCONFIG_H
+#define GCEMU_NETWORKCONFIG_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#define SNetworkConfig NetworkConfig::GetInstance()
+
+// What a socket does once its send queue goes past the high watermark.
+enum class SendQueueOverflowPolicy
+{
+    Disconnect,
+    DropNonCritical
+};
+
+// Network tuning options, read once from the config file so the sockets don't have to query it on the hot path.
+class NetworkConfig
+{
+public:
+    static NetworkConfig& GetInstance()
+    {
+        static NetworkConfig instance;
+        return instance;
+    }
+
+    NetworkConfig(NetworkConfig const&) = delete;
+    void operator=(NetworkConfig const&) = delete;
+
+    bool Load();
+
+    // Name of the I/O backend Asio was built with, which it picks at compile time.
+    static const char* GetIoEngine();
+
+    bool IsCorkEnabled() const { return m_corkEnabled; }
+    std::chrono::milliseconds GetCorkMaxDelay() const { return m_corkMaxDelay; }
+    size_t GetCorkMaxBytes() const { return m_corkMaxBytes; }
+
+    bool IsReusePortEnabled() const { return m_reusePortEnabled; }
+
+    size_t GetPoolPrewarm() const { return m_poolPrewarm; }
+
+    size_t GetReceiveBufferInitialSize() const { return m_receiveBufferInitialSize; }
+    size_t GetReceiveBufferMaxSize() const { return m_receiveBufferMaxSize; }
+    size_t GetMaxFrameSize() const { return m_maxFrameSize; }
+    std::chrono::milliseconds GetBufferIdleTimeout() const { return m_bufferIdleTimeout; }
+    std::chrono::milliseconds GetSweepInterval() const { return m_sweepInterval; }
+
+    std::chrono::milliseconds GetTimerResolution() const { return m_timerResolution; }
+    std::chrono::milliseconds GetIdleTimeout() const { return m_idleTimeout; }
+    std::chrono::milliseconds GetHandshakeTimeout() const { return m_handshakeTimeout; }
+    std::chrono::milliseconds GetHeartbeatTimeout() const { return m_heartbeatTimeout; }
+
+    size_t GetSendQueueHighWatermark() const { return m_sendQueueHighWatermark; }
+    size_t GetSendQueueLowWatermark() const { return m_sendQueueLowWatermark; }
+    size_t GetSendQueueMaxBytes() const { return m_sendQueueMaxBytes; }
+    SendQueueOverflowPolicy GetSendQueueOverflowPolicy() const { return m_sendQueueOverflowPolicy; }
+    size_t GetPoolMaxFreeBytes() const { return m_poolMaxFreeBytes; }
+
+    uint32_t GetMaxConnectionsPerIp() const { return m_maxConnectionsPerIp; }
+    uint32_t GetAcceptRatePerIp() const { return m_acceptRatePerIp; }
+    uint32_t GetAcceptBurstPerIp() const { return m_acceptBurstPerIp; }
+    size_t GetAdmissionTableSize() const { return m_admissionTableSize; }
+
+    uint32_t GetMigrationThreshold() const { return m_migrationThreshold; }
+    size_t GetMigrationBatch() const { return m_migrationBatch; }
+
+    std::chrono::seconds GetStatsInterval() const { return m_statsInterval; }
+
+private:
+    NetworkConfig() {}
+
+    // Corking: writes issued while handling one event are held back and flushed together once the handler returns
+    // (or after the max delay, if set), unless more than the max bytes are pending.
+    bool m_corkEnabled = false;
+    std::chrono::milliseconds m_corkMaxDelay {0};
+    size_t m_corkMaxBytes = 16384;
+
+    // Each NetworkThread runs its own SO_REUSEPORT acceptor instead of sharing the listener's one.
+    bool m_reusePortEnabled = false;
+
+    // Number of connections each NetworkThread pre-allocates socket and buffer memory for at startup.
+    size_t m_poolPrewarm = 0;
+
+    // Receive buffers are allocated on the first read, double while a frame doesn't fit (up to the max size) and are
+    // released again once the connection has been idle for the timeout. Both sizes are powers of two.
+    size_t m_receiveBufferInitialSize = 1024;
+    size_t m_receiveBufferMaxSize = 65536;
+    std::chrono::milliseconds m_bufferIdleTimeout {10000};
+
+    // Largest frame a peer may send (see FrameDecoder). A connection announcing a bigger one is closed before any of
+    // it is buffered. Capped by the receive buffer max size, as a frame has to fit in the buffer whole.
+    size_t m_maxFrameSize = 16384;
+
+    // How often each NetworkThread releases idle buffers and trims its pools down to the max free bytes.
+    std::chrono::milliseconds m_sweepInterval {1000};
+    size_t m_poolMaxFreeBytes = 4 * 1024 * 1024;
+
+    // Timeouts are driven by a timing wheel per NetworkThread that turns once per resolution, so they fire up to one
+    // resolution late. A timeout of 0 disables it. Connections are closed when nothing was received for the idle
+    // timeout, when the client hasn't logged in within the handshake timeout, or when it stops sending heartbeats.
+    std::chrono::milliseconds m_timerResolution {100};
+    std::chrono::milliseconds m_idleTimeout {300000};
+    std::chrono::milliseconds m_handshakeTimeout {30000};
+    std::chrono::milliseconds m_heartbeatTimeout {60000};
+
+    // A socket whose send queue grows past the high watermark is backpressured until it drains below the low one.
+    // Depending on the policy it is then either disconnected, or has its non-critical packets dropped until the
+    // queue reaches the max bytes, at which point it is disconnected anyway.
+    size_t m_sendQueueHighWatermark = 262144;
+    size_t m_sendQueueLowWatermark = 65536;
+    size_t m_sendQueueMaxBytes = 1048576;
+    SendQueueOverflowPolicy m_sendQueueOverflowPolicy = SendQueueOverflowPolicy::Disconnect;
+
+    // Admission control (see AdmissionControl): live connections allowed per source address, and how many new ones it
+    // may open per second, after an initial burst. 0 disables a limit. The table size must be a power of two.
+    uint32_t m_maxConnectionsPerIp = 32;
+    uint32_t m_acceptRatePerIp = 10;
+    uint32_t m_acceptBurstPerIp = 20;
+    size_t m_admissionTableSize = 65536;
+
+    // Established connections are moved from the most to the least loaded NetworkThread when their load scores (see
+    // NetworkContext::GetLoadScore) are more than the threshold apart, at most a batch per sweep. 0 disables it.
+    uint32_t m_migrationThreshold = 0;
+    size_t m_migrationBatch = 16;
+
+    std::chrono::seconds m_statsInterval {0};
+};
+
+#endif //GCEMU_NETWORKCONFIG_H
@@ -0,0 +1,159 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "NetworkContext.h"
+#include "NetworkConfig.h"
+#include "PacketBuffer.h"
+#include <algorithm>
+#include <ctime>
+#include <spdlog/spdlog.h>
+
+namespace
+{
+    // CPU time used by the calling thread so far.
+    std::chrono::nanoseconds GetThreadCpuTime()
+    {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+        timespec time {};
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0)
+            return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+#endif
+        return std::chrono::nanoseconds(0);
+    }
+}
+
+NetworkContext::NetworkContext(uint8_t index, size_t socketBlockSize) : m_index(index),
+                                                                      m_timingWheel(SNetworkConfig.GetTimerResolution()),
+                                                                      m_socketPool(std::make_shared<MemoryPool>(socketBlockSize)),
+                                                                      m_bufferPool(std::make_shared<BufferPool>()),
+                                                                      m_inbox(m_ioContext)
+{
+}
+
+uint8_t NetworkContext::GetIndex() const
+{
+    return m_index;
+}
+
+boost::asio::io_context& NetworkContext::GetIoContext()
+{
+    return m_ioContext;
+}
+
+const std::shared_ptr<MemoryPool>& NetworkContext::GetSocketPool() const
+{
+    return m_socketPool;
+}
+
+const std::shared_ptr<BufferPool>& NetworkContext::GetBufferPool() const
+{
+    return m_bufferPool;
+}
+
+TimingWheel& NetworkContext::GetTimingWheel()
+{
+    return m_timingWheel;
+}
+
+NetworkInbox& NetworkContext::GetInbox()
+{
+    return m_inbox;
+}
+
+void NetworkContext::Prewarm(size_t socketCount)
+{
+    m_socketPool->Reserve(socketCount);
+    m_bufferPool->Reserve(SNetworkConfig.GetReceiveBufferInitialSize(), socketCount);
+}
+
+void NetworkContext::TrimPools()
+{
+    // Prewarmed sockets are kept, anything past that was only needed for a spike in connections.
+    m_socketPool->Trim(SNetworkConfig.GetPoolPrewarm());
+    m_bufferPool->Trim(std::max(SNetworkConfig.GetPoolMaxFreeBytes(),
+                                SNetworkConfig.GetPoolPrewarm() * SNetworkConfig.GetReceiveBufferInitialSize()));
+}
+
+void NetworkContext::SetConnectionMemory(size_t connections, size_t bytes)
+{
+    m_connections.store(connections, std::memory_order_relaxed);
+    m_connectionMemory.store(bytes, std::memory_order_relaxed);
+}
+
+void NetworkContext::LogPoolStats()
+{
+    uint64_t socketHits, socketMisses;
+    size_t socketFreeBlocks;
+    m_socketPool->GetStats(socketHits, socketMisses, socketFreeBlocks);
+
+    uint64_t bufferHits, bufferMisses;
+    size_t bufferFreeBytes;
+    m_bufferPool->GetStats(bufferHits, bufferMisses, bufferFreeBytes);
+
+    auto hitRate = [] (uint64_t hits, uint64_t misses) { return hits + misses ? 100.0 * hits / (hits + misses) : 100.0; };
+
+    spdlog::info("NetworkContext[{0}]: load {1} ({2}/1000 busy, {3} bytes/s, {4} bytes queued)", m_index,
+                 GetLoadScore(m_connections.load(std::memory_order_relaxed)), m_busyPermille.load(std::memory_order_relaxed),
+                 m_bytesPerSecond.load(std::memory_order_relaxed), m_queuedBytes.load(std::memory_order_relaxed));
+    spdlog::info("NetworkContext[{0}]: {1} connections using {2} bytes, socket pool {3:.1f}% hits ({4} free), "
+                 "buffer pool {5:.1f}% hits ({6} bytes free)", m_index, m_connections.load(std::memory_order_relaxed),
+                 m_connectionMemory.load(std::memory_order_relaxed), hitRate(socketHits, socketMisses), socketFreeBlocks,
+                 hitRate(bufferHits, bufferMisses), bufferFreeBytes);
+}
+
+void NetworkContext::GetPoolUsage(size_t& sockets, size_t& buffers) const
+{
+    sockets = m_socketPool->GetUsedBlocks();
+    buffers = m_bufferPool->GetUsedBuffers();
+}
+
+void NetworkContext::AddBytesTransferred(size_t bytes)
+{
+    m_bytesTransferred += bytes;
+}
+
+void NetworkContext::UpdateLoad(size_t queuedBytes)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::nanoseconds cpuTime = GetThreadCpuTime();
+
+    // The first call only takes the starting point.
+    if (m_sampleTime.time_since_epoch().count())
+    {
+        const double elapsed = std::chrono::duration<double>(now - m_sampleTime).count();
+        if (elapsed > 0)
+        {
+            const double busy = std::chrono::duration<double>(cpuTime - m_sampledCpuTime).count() / elapsed;
+            const uint32_t busyPermille = (uint32_t) std::min(busy * 1000, 1000.0);
+
+            // Averaged with the previous sample, so a single burst doesn't move connections around.
+            m_busyPermille.store((m_busyPermille.load(std::memory_order_relaxed) + busyPermille) / 2, std::memory_order_relaxed);
+            m_bytesPerSecond.store((uint64_t) ((m_bytesTransferred - m_sampledBytes) / elapsed), std::memory_order_relaxed);
+        }
+    }
+
+    m_sampleTime = now;
+    m_sampledCpuTime = cpuTime;
+    m_sampledBytes = m_bytesTransferred;
+    m_queuedBytes.store(queuedBytes, std::memory_order_relaxed);
+}
+
+uint64_t NetworkContext::GetLoadScore(size_t connections) const
+{
+    return m_busyPermille.load(std::memory_order_relaxed) +
+           m_bytesPerSecond.load(std::memory_order_relaxed) / BYTES_PER_SECOND_PER_POINT +
+           m_queuedBytes.load(std::memory_order_relaxed) / QUEUED_BYTES_PER_POINT +
+           connections / CONNECTIONS_PER_POINT;
+}
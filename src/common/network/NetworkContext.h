@@ -0,0 +1,107 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_NETWORKCONTEXT_H
+#define GCEMU_NETWORKCONTEXT_H
+
+#include "BufferPool.h"
+#include "NetworkInbox.h"
+#include "../util/MemoryPool.h"
+#include "../util/TimingWheel.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <boost/asio.hpp>
+
+// Per-thread state shared by all the sockets served by one NetworkThread: the io_context they run on, the pools
+// their memory comes from, the timing wheel their timeouts are kept in and the inbox other threads hand them work
+// through.
+class NetworkContext
+{
+public:
+    NetworkContext(uint8_t index, size_t socketBlockSize);
+
+    NetworkContext(const NetworkContext&) = delete;
+    NetworkContext& operator=(const NetworkContext&) = delete;
+
+    uint8_t GetIndex() const;
+    boost::asio::io_context& GetIoContext();
+
+    const std::shared_ptr<MemoryPool>& GetSocketPool() const;
+    const std::shared_ptr<BufferPool>& GetBufferPool() const;
+
+    // Only to be used from the thread running the io_context.
+    TimingWheel& GetTimingWheel();
+
+    // Safe to use from any thread.
+    NetworkInbox& GetInbox();
+
+    // Fills the pools with enough memory for the given number of connections.
+    void Prewarm(size_t socketCount);
+
+    // Gives unused pool memory back to the heap, keeping at most the configured amount of free buffers.
+    void TrimPools();
+
+    // Memory held by the connections of this thread, as of the last sweep.
+    void SetConnectionMemory(size_t connections, size_t bytes);
+    void LogPoolStats();
+
+    // Sockets and receive buffers taken from the pools and not given back yet. Safe to call from any thread.
+    void GetPoolUsage(size_t& sockets, size_t& buffers) const;
+
+    // Load accounting. Bytes received and sent are counted as they go, by the thread running the io_context, and
+    // UpdateLoad is called periodically from that same thread to turn them, along with the CPU time the thread used
+    // and the bytes waiting in its send queues, into the sample other threads read.
+    void AddBytesTransferred(size_t bytes);
+    void UpdateLoad(size_t queuedBytes);
+
+    // Single figure to compare threads by, where 1000 stands for a thread kept fully busy. Mostly the share of CPU
+    // time used, plus a little for the traffic, queued data and connections, so threads that are equally idle still
+    // end up with an even share of the connections. Safe to call from any thread.
+    uint64_t GetLoadScore(size_t connections) const;
+
+private:
+    uint8_t m_index;
+
+    // Declared first so it outlives the sockets still referenced by pending handlers when the io_context goes away.
+    TimingWheel m_timingWheel;
+    boost::asio::io_context m_ioContext;
+
+    std::shared_ptr<MemoryPool> m_socketPool;
+    std::shared_ptr<BufferPool> m_bufferPool;
+
+    std::atomic<size_t> m_connections {0};
+    std::atomic<size_t> m_connectionMemory {0};
+
+    // Score points per byte per second of traffic, per queued byte and per connection.
+    static constexpr uint64_t BYTES_PER_SECOND_PER_POINT = 65536;
+    static constexpr uint64_t QUEUED_BYTES_PER_POINT = 16384;
+    static constexpr uint64_t CONNECTIONS_PER_POINT = 8;
+
+    uint64_t m_bytesTransferred = 0;
+    uint64_t m_sampledBytes = 0;
+    std::chrono::nanoseconds m_sampledCpuTime {0};
+    std::chrono::steady_clock::time_point m_sampleTime;
+
+    std::atomic<uint32_t> m_busyPermille {0};
+    std::atomic<uint64_t> m_bytesPerSecond {0};
+    std::atomic<size_t> m_queuedBytes {0};
+
+    // Last, so the sockets held by tasks that never ran go away while the pools and the timing wheel are still there.
+    NetworkInbox m_inbox;
+};
+
+#endif //GCEMU_NETWORKCONTEXT_H
@@ -0,0 +1,151 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_NETWORKINBOX_H
+#define GCEMU_NETWORKINBOX_H
+
+#include "NetworkStats.h"
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <boost/asio.hpp>
+
+// Work handed to a NetworkThread from other threads, e.g. packets sent to one of its sockets by a database callback.
+// Producers push onto a lock-free stack; the first push onto an empty inbox wakes the thread up with a single post,
+// and the thread then takes everything that piled up in one exchange and runs it in the order it was pushed. A burst
+// of sends from other threads therefore costs one wakeup instead of one post per packet.
+class NetworkInbox
+{
+public:
+    explicit NetworkInbox(boost::asio::io_context& ioContext) : m_ioContext(ioContext) {}
+
+    NetworkInbox(const NetworkInbox&) = delete;
+    NetworkInbox& operator=(const NetworkInbox&) = delete;
+
+    ~NetworkInbox()
+    {
+        // Tasks that never got to run, the thread is gone.
+        DeleteNodes(m_batch);
+        DeleteNodes(m_head.exchange(nullptr, std::memory_order_acquire));
+    }
+
+    // Queues a task to run on the thread of the io_context. Safe to call from any thread.
+    template <typename Task>
+    void Push(Task&& task)
+    {
+        Node* node = new TaskNode<std::decay_t<Task>>(std::forward<Task>(task));
+
+        Node* head = m_head.load(std::memory_order_relaxed);
+        do
+            node->Next = head;
+        while (!m_head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+
+        // Whoever finds the inbox empty is the one to wake the thread up. Anything pushed after that, until the thread
+        // takes the batch, is picked up by the same wakeup.
+        if (!head)
+        {
+            NetworkStats::Increment(SNetworkStats.InboxWakeups);
+            boost::asio::post(m_ioContext, [this] () { Drain(); });
+        }
+    }
+
+private:
+    struct Node
+    {
+        Node* Next = nullptr;
+
+        virtual ~Node() = default;
+        virtual void Run() = 0;
+    };
+
+    template <typename Task>
+    struct TaskNode : Node
+    {
+        template <typename T>
+        explicit TaskNode(T&& task) : TaskFunction(std::forward<T>(task)) {}
+
+        void Run() override
+        {
+            TaskFunction();
+        }
+
+        Task TaskFunction;
+    };
+
+    static void DeleteNodes(Node* node)
+    {
+        while (node)
+        {
+            Node* next = node->Next;
+            delete node;
+            node = next;
+        }
+    }
+
+    void Drain()
+    {
+        // Left over by a task that threw, those were pushed before anything still on the stack.
+        uint64_t count = RunBatch();
+
+        Node* node = m_head.exchange(nullptr, std::memory_order_acquire);
+
+        // The stack holds the newest task first.
+        while (node)
+        {
+            Node* next = node->Next;
+            node->Next = m_batch;
+            m_batch = node;
+            node = next;
+        }
+
+        count += RunBatch();
+        NetworkStats::Increment(SNetworkStats.InboxTasks, count);
+    }
+
+    // Each task is unlinked and owned before it runs, so one that throws is still freed, and the tasks behind it stay
+    // in the batch for another Drain instead of leaking.
+    uint64_t RunBatch()
+    {
+        uint64_t count = 0;
+        try
+        {
+            while (m_batch)
+            {
+                std::unique_ptr<Node> node(m_batch);
+                m_batch = node->Next;
+                node->Run();
+                count++;
+            }
+        }
+        catch (...)
+        {
+            if (m_batch)
+                boost::asio::post(m_ioContext, [this] () { Drain(); });
+
+            throw;
+        }
+
+        return count;
+    }
+
+    boost::asio::io_context& m_ioContext;
+    std::atomic<Node*> m_head {nullptr};
+
+    // Tasks taken off the stack, in order, that haven't run yet. Only touched by the thread of the io_context.
+    Node* m_batch = nullptr;
+};
+
+#endif //GCEMU_NETWORKINBOX_H
@@ -0,0 +1,83 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_NETWORKSTATS_H
+#define GCEMU_NETWORKSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <spdlog/spdlog.h>
+
+#define SNetworkStats NetworkStats::GetInstance()
+
+// Process-wide network counters. They are only ever incremented with relaxed ordering, so reading them gives an
+// approximate, but cheap, view of what the sockets are doing.
+class NetworkStats
+{
+public:
+    static NetworkStats& GetInstance()
+    {
+        static NetworkStats instance;
+        return instance;
+    }
+
+    NetworkStats(NetworkStats const&) = delete;
+    void operator=(NetworkStats const&) = delete;
+
+    static void Increment(std::atomic<uint64_t>& counter, uint64_t value = 1)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void Log() const
+    {
+        const uint64_t buffersQueued = BuffersQueued.load(std::memory_order_relaxed);
+        const uint64_t writeCalls = WriteCalls.load(std::memory_order_relaxed);
+
+        spdlog::info("NetworkStats: {0} buffers queued, {1} writes issued ({2} saved), {3} bytes sent, {4} corked flushes",
+                     buffersQueued, writeCalls, buffersQueued > writeCalls ? buffersQueued - writeCalls : 0,
+                     BytesSent.load(std::memory_order_relaxed), CorkFlushes.load(std::memory_order_relaxed));
+        spdlog::info("NetworkStats: {0} send queue overflows, {1} packets dropped, {2} slow consumers disconnected",
+                     SendQueueOverflows.load(std::memory_order_relaxed), PacketsDropped.load(std::memory_order_relaxed),
+                     SlowConsumerDisconnects.load(std::memory_order_relaxed));
+        spdlog::info("NetworkStats: {0} connections rejected by the per-IP cap, {1} by the accept rate, admission table full "
+                     "{2} times", AdmissionRejectedByCap.load(std::memory_order_relaxed),
+                     AdmissionRejectedByRate.load(std::memory_order_relaxed), AdmissionTableFull.load(std::memory_order_relaxed));
+        spdlog::info("NetworkStats: {0} closed sockets reaped", SocketsReaped.load(std::memory_order_relaxed));
+        spdlog::info("NetworkStats: {0} tasks handed over between threads, in {1} wakeups",
+                     InboxTasks.load(std::memory_order_relaxed), InboxWakeups.load(std::memory_order_relaxed));
+        spdlog::info("NetworkStats: {0} sockets migrated between threads", SocketsMigrated.load(std::memory_order_relaxed));
+    }
+
+    std::atomic<uint64_t> BuffersQueued {0};
+    std::atomic<uint64_t> WriteCalls {0};
+    std::atomic<uint64_t> BytesSent {0};
+    std::atomic<uint64_t> CorkFlushes {0};
+    std::atomic<uint64_t> SendQueueOverflows {0};
+    std::atomic<uint64_t> PacketsDropped {0};
+    std::atomic<uint64_t> SlowConsumerDisconnects {0};
+    std::atomic<uint64_t> AdmissionRejectedByCap {0};
+    std::atomic<uint64_t> AdmissionRejectedByRate {0};
+    std::atomic<uint64_t> AdmissionTableFull {0};
+    std::atomic<uint64_t> SocketsReaped {0};
+    std::atomic<uint64_t> InboxTasks {0};
+    std::atomic<uint64_t> InboxWakeups {0};
+    std::atomic<uint64_t> SocketsMigrated {0};
+
+private:
+    NetworkStats() {}
+};
+
+#endif //GCEMU_NETWORKSTATS_H
@@ -17,74 +17,340 @@
 #define GCEMU_NETWORKTHREAD_H
 
 #include <memory>
-#include <mutex>
 #include <thread>
-#include <unordered_set>
 #include <boost/asio.hpp>
+#include <spdlog/spdlog.h>
+#include "NetworkConfig.h"
+#include "NetworkContext.h"
+#include "NetworkStats.h"
+#include "Packet.h"
 #include "Socket.h"
+#include "SocketTable.h"
+#include "../util/MemoryPool.h"
+#include "../util/ThreadAffinity.h"
 
 template <typename SocketType>
 class NetworkThread
 {
 public:
-    NetworkThread();
+    explicit NetworkThread(uint8_t index = 0);
     ~NetworkThread();
 
+    // Number of live sockets. Safe to call from any thread.
     size_t Size() const;
 
+    // Creates a socket bound to this thread's io_context. It is not tracked until it is handed to AddSocket.
     std::shared_ptr<SocketType> CreateSocket();
+
+    // Registers an accepted socket and opens it, unless admission control turns it away. The admission check is done
+    // on the calling (accepting) thread, so rejected connections never reach this one. The socket table is only ever
+    // touched from this thread, so calls from other threads are forwarded to it.
+    void AddSocket(const std::shared_ptr<SocketType>& socket);
     void RemoveSocket(Socket *socket);
 
+    // Opens an acceptor owned by this thread on the given endpoint, with SO_REUSEPORT set so several threads can
+    // listen on the same port and let the kernel spread the incoming connections between them.
+    void Listen(const boost::asio::ip::tcp::endpoint& endpoint);
+    void StopListening();
+
+    // Closes every socket once its pending data has been sent. Returns right away; Size() drops to 0 once done.
+    void Drain();
+
+    // Sends a serialized packet to every socket of this thread, each sealing it with its own keys (see
+    // LoginSocket::SendPlaintext). Done in a single task on this thread. Safe to call from any thread.
+    void Broadcast(const Packet::SharedPlaintext& plaintext, bool critical);
+
+    // See NetworkContext::GetLoadScore. Safe to call from any thread.
+    uint64_t GetLoadScore() const;
+
+    // Moves up to count sockets that are open and idle (see Socket::CanMigrate) to the target thread. Returns right
+    // away. The sockets get a new session id on the target.
+    void MigrateSockets(size_t count, const std::shared_ptr<NetworkThread>& target);
+
+    void LogPoolStats();
+
+    // See NetworkContext::GetPoolUsage. Safe to call from any thread.
+    void GetPoolUsage(size_t& sockets, size_t& buffers) const;
+
 private:
-    boost::asio::io_context m_ioContext;
+    // Turns the timing wheel. This is the only timer the thread arms on its io_context; everything else that needs a
+    // timeout, sockets included, is kept in the wheel.
+    void ScheduleTick();
+
+    // Periodically reaps closed sockets that are somehow still tracked, releases the buffers of idle connections,
+    // updates the memory gauge and the load sample, and trims the pools.
+    void Sweep();
+
+    void StartAccept();
+    void OnAccept(const std::shared_ptr<SocketType>& socket, const boost::system::error_code& ec);
+
+    // Registers a socket migrated from another thread.
+    void AttachSocket(const std::shared_ptr<SocketType>& socket);
+
+    // Room left in each socket pool block for the shared_ptr control block allocated along with the socket.
+    static constexpr size_t SOCKET_BLOCK_OVERHEAD = 64;
+
+    NetworkContext m_context;
+    boost::asio::io_context& m_ioContext;
     std::shared_ptr<boost::asio::io_context::work> m_work;
     std::thread m_serviceThread;
-    std::unordered_set<std::shared_ptr<SocketType>> m_sockets;
+    std::unique_ptr<boost::asio::ip::tcp::acceptor> m_acceptor;
 
-    std::mutex m_socketLock;
+    SocketTable<SocketType> m_sockets;
+    boost::asio::steady_timer m_tickTimer;
+    TimingWheel::Timer m_sweepTimer;
 };
 
 template <typename SocketType>
-NetworkThread<SocketType>::NetworkThread() : m_work(std::make_unique<boost::asio::io_context::work>(m_ioContext)),
-                                 m_serviceThread([this] { boost::system::error_code ec; this->m_ioContext.run(); })
+NetworkThread<SocketType>::NetworkThread(uint8_t index) : m_context(index, sizeof(SocketType) + SOCKET_BLOCK_OVERHEAD),
+                                 m_ioContext(m_context.GetIoContext()),
+                                 m_work(std::make_unique<boost::asio::io_context::work>(m_ioContext)),
+                                 m_serviceThread([this, index]
+                                 {
+                                     SThreadAffinity.Apply(ThreadAffinity::ThreadRole::Network, index);
+                                     this->m_ioContext.run();
+                                 }),
+                                 m_sockets(index),
+                                 m_tickTimer(m_ioContext),
+                                 m_sweepTimer([this] () { Sweep(); })
 {
+    // Done from the (pinned) service thread, so the memory is first touched by the thread that is going to use it and
+    // ends up on its NUMA node.
+    if (const size_t prewarm = SNetworkConfig.GetPoolPrewarm())
+        boost::asio::post(m_ioContext, [this, prewarm] () { m_context.Prewarm(prewarm); });
+
+    boost::asio::post(m_ioContext, [this] ()
+    {
+        m_context.GetTimingWheel().Schedule(m_sweepTimer, SNetworkConfig.GetSweepInterval());
+        ScheduleTick();
+    });
 }
 
 template <typename SocketType>
 size_t NetworkThread<SocketType>::Size() const
 {
-    return m_sockets.size();
+    return m_sockets.Size();
 }
 
 template <typename SocketType>
 NetworkThread<SocketType>::~NetworkThread()
 {
-    for (auto & socket : m_sockets)
-    {
-        if (!socket->IsClosed())
-            socket->Close();
-    }
-
     m_ioContext.stop();
     if (m_serviceThread.joinable())
         m_serviceThread.join();
+
+    // The service thread is gone, so the table can be walked from here.
+    m_sockets.ForEach([] (const std::shared_ptr<SocketType>& socket)
+    {
+        if (!socket->IsClosed())
+            socket->Close();
+    });
 }
 
 template <typename SocketType>
 std::shared_ptr<SocketType> NetworkThread<SocketType>::CreateSocket()
 {
-    std::lock_guard<std::mutex> lock(m_socketLock);
+    return std::allocate_shared<SocketType>(PoolAllocator<SocketType>(m_context.GetSocketPool()), m_context,
+                                            [this] (Socket* socket) { this->RemoveSocket(socket); });
+}
 
-    auto const i = m_sockets.emplace(std::make_shared<SocketType>(m_ioContext, [this] (Socket* socket) { this->RemoveSocket(socket); }));
+template <typename SocketType>
+void NetworkThread<SocketType>::AddSocket(const std::shared_ptr<SocketType>& socket)
+{
+    if (!socket->Admit())
+        return;
 
-    return *i.first;
+    boost::asio::dispatch(m_ioContext, [this, socket] ()
+    {
+        socket->SetSessionId(m_sockets.Insert(socket));
+        if (!socket->Open())
+            socket->Close();
+    });
 }
 
 template <typename SocketType>
 void NetworkThread<SocketType>::RemoveSocket(Socket *socket)
 {
-    std::lock_guard<std::mutex> lock(m_socketLock);
-    m_sockets.erase(socket->shared<SocketType>());
+    const uint64_t sessionId = socket->GetSessionId();
+    if (sessionId == SocketTable<SocketType>::INVALID_HANDLE)
+        return;
+
+    boost::asio::dispatch(m_ioContext, [this, sessionId] ()
+    {
+        if (std::shared_ptr<SocketType> socket = m_sockets.Remove(sessionId))
+            socket->SetReclaimed();
+    });
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::Drain()
+{
+    boost::asio::post(m_ioContext, [this] ()
+    {
+        m_sockets.ForEach([] (const std::shared_ptr<SocketType>& socket) { socket->CloseWhenFlushed(); });
+    });
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::Broadcast(const Packet::SharedPlaintext& plaintext, bool critical)
+{
+    m_context.GetInbox().Push([this, plaintext, critical] ()
+    {
+        m_sockets.ForEach([&plaintext, critical] (const std::shared_ptr<SocketType>& socket)
+        {
+            socket->SendPlaintext(plaintext, critical);
+        });
+    });
+}
+
+template <typename SocketType>
+uint64_t NetworkThread<SocketType>::GetLoadScore() const
+{
+    return m_context.GetLoadScore(Size());
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::MigrateSockets(size_t count, const std::shared_ptr<NetworkThread>& target)
+{
+    boost::asio::post(m_ioContext, [this, count, target] ()
+    {
+        size_t migrated = 0;
+        m_sockets.ForEach([this, count, &target, &migrated] (const std::shared_ptr<SocketType>& socket)
+        {
+            if (migrated == count || !socket->CanMigrate())
+                return;
+
+            m_sockets.Remove(socket->GetSessionId());
+            socket->Migrate(target->m_context, [target, socket] () { target->AttachSocket(socket); });
+            migrated++;
+        });
+
+        NetworkStats::Increment(SNetworkStats.SocketsMigrated, migrated);
+    });
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::AttachSocket(const std::shared_ptr<SocketType>& socket)
+{
+    if (!socket->Attach([this] (Socket* socket) { this->RemoveSocket(socket); }))
+        return;
+
+    socket->SetSessionId(m_sockets.Insert(socket));
+    socket->Resume();
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::LogPoolStats()
+{
+    m_context.LogPoolStats();
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::GetPoolUsage(size_t& sockets, size_t& buffers) const
+{
+    m_context.GetPoolUsage(sockets, buffers);
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::ScheduleTick()
+{
+    m_tickTimer.expires_at(m_context.GetTimingWheel().GetNextTickTime());
+    m_tickTimer.async_wait([this] (const boost::system::error_code& ec)
+    {
+        if (ec)
+            return;
+
+        m_context.GetTimingWheel().Advance(std::chrono::steady_clock::now());
+        ScheduleTick();
+    });
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::Sweep()
+{
+    const auto idleSince = std::chrono::steady_clock::now() - SNetworkConfig.GetBufferIdleTimeout();
+
+    size_t memory = 0;
+    size_t queuedBytes = 0;
+    m_sockets.ForEach([this, &memory, &queuedBytes, idleSince] (const std::shared_ptr<SocketType>& socket)
+    {
+        // Closed sockets remove themselves once torn down; one still here a whole sweep later missed it.
+        if (socket->IsClosed())
+        {
+            if (m_sockets.Remove(socket->GetSessionId()))
+            {
+                socket->SetReclaimed();
+                NetworkStats::Increment(SNetworkStats.SocketsReaped);
+            }
+
+            return;
+        }
+
+        socket->ReleaseIdleMemory(idleSince);
+        memory += socket->GetMemoryUsage();
+        queuedBytes += socket->GetQueuedBytes();
+    });
+
+    m_context.SetConnectionMemory(m_sockets.Size(), memory);
+    m_context.UpdateLoad(queuedBytes);
+    m_context.TrimPools();
+
+    m_context.GetTimingWheel().Schedule(m_sweepTimer, SNetworkConfig.GetSweepInterval());
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::Listen(const boost::asio::ip::tcp::endpoint& endpoint)
+{
+#ifdef SO_REUSEPORT
+    typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+
+    m_acceptor = std::make_unique<boost::asio::ip::tcp::acceptor>(m_ioContext);
+    m_acceptor->open(endpoint.protocol());
+    m_acceptor->set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    m_acceptor->set_option(reuse_port(true));
+    m_acceptor->bind(endpoint);
+    m_acceptor->listen();
+
+    boost::asio::post(m_ioContext, [this] () { StartAccept(); });
+#else
+    throw boost::system::system_error(boost::asio::error::operation_not_supported, "SO_REUSEPORT");
+#endif
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::StopListening()
+{
+    boost::asio::post(m_ioContext, [this] ()
+    {
+        if (m_acceptor)
+            m_acceptor->close();
+    });
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::StartAccept()
+{
+    std::shared_ptr<SocketType> socket = CreateSocket();
+
+    m_acceptor->async_accept(socket->GetAsioSocket(), [this, socket] (const boost::system::error_code& ec)
+    {
+        this->OnAccept(socket, ec);
+    });
+}
+
+template <typename SocketType>
+void NetworkThread<SocketType>::OnAccept(const std::shared_ptr<SocketType>& socket, const boost::system::error_code& ec)
+{
+    if (ec)
+    {
+        if (ec != boost::asio::error::operation_aborted)
+            spdlog::error("NetworkThread::OnAccept: {0}", ec.message());
+    }
+    else
+        AddSocket(socket);
+
+    if (m_acceptor->is_open())
+        StartAccept();
 }
 
 #endif //GCEMU_NETWORKTHREAD_H
@@ -19,105 +19,191 @@
 #include <boost/asio.hpp>
 #include <spdlog/spdlog.h>
 
-bool Packet::LoadData(const std::vector<uint8_t>& data, const std::shared_ptr<SecurityAssociation>& sa)
+namespace
+{
+    // Plaintext of the last frame decoded on this thread, which the PacketReader handed out points into. It grows to
+    // the largest frame seen and stays that way.
+    thread_local std::vector<uint8_t> t_plaintext;
+
+    // Payload of the last compressed packet decoded on this thread.
+    thread_local std::vector<uint8_t> t_decompressedPayload;
+
+    // The decompressed size comes from the client, and is allocated before anything is decompressed. No packet of the
+    // game comes anywhere near it.
+    constexpr uint32_t MAX_DECOMPRESSED_PAYLOAD_SIZE = 1 << 20;
+}
+
+Packet::Packet(const PacketReader& reader) : ByteBuffer(reader.GetPayloadLength()), m_opcode(reader.GetOpcode()),
+                                             m_payloadLength(reader.GetPayloadLength())
+{
+    Append(reader.GetPayload(), reader.GetPayloadLength());
+}
+
+bool Packet::Decode(const uint8_t* frame, size_t length, const std::shared_ptr<SecurityAssociation>& sa, PacketReader& reader)
 {
     // The minimum packet size is the sum of the size of PacketHeader, opcode (2 bytes), payload length (4 bytes)
     // and the size of PacketAuthentication.
-    size_t minPacketSize = sizeof(PacketHeader) + 6 + sizeof(PacketAuthentication);
-    if (data.size() < minPacketSize)
+    const size_t minPacketSize = sizeof(PacketHeader) + 6 + sizeof(PacketAuthentication);
+    if (length < minPacketSize)
     {
-        spdlog::error("Packet::LoadData: Error: packet doesn't have enough data.");
+        spdlog::error("Packet::Decode: Error: packet doesn't have enough data.");
         return false;
     }
 
-    // Copy packet header from the start of the packet data
-    memcpy(&m_packetHeader, &(*data.begin()), sizeof(m_packetHeader));
+    PacketHeader packetHeader;
+    memcpy(&packetHeader, frame, sizeof(packetHeader));
 
-    // Read packet payload
-    ReadPayload(data, sa);
+    // TODO: verify the ICV authentication
 
-    // Copy packet authentication from the end of the packet data
-    memcpy(&m_packetAuthentication, &(*(data.end() - sizeof(m_packetAuthentication))), sizeof(m_packetAuthentication));
+    const size_t encryptedLength = length - sizeof(PacketHeader) - sizeof(PacketAuthentication);
+    if (encryptedLength % 8)
+    {
+        spdlog::error("Packet::Decode: Error: the payload isn't made of whole DES blocks.");
+        return false;
+    }
 
-    // TODO: verify the ICV authentication
+    if (t_plaintext.size() < encryptedLength)
+        t_plaintext.resize(encryptedLength);
 
-    return true;
-}
+    uint8_t* decryptedPayload = t_plaintext.data();
+    if (!sa->DecryptData(frame + sizeof(PacketHeader), encryptedLength, packetHeader.IV, decryptedPayload))
+        return false;
 
-std::vector<uint8_t> Packet::GetDataToSend(const std::shared_ptr<SecurityAssociation>& sa)
-{
-    m_payloadLength = Size();
-    std::vector<uint8_t> payload;
-    payload.push_back(m_opcode >> 8);
-    payload.push_back(m_opcode);
-    payload.push_back(m_payloadLength >> 24);
-    payload.push_back(m_payloadLength >> 16);
-    payload.push_back(m_payloadLength >> 8);
-    payload.push_back(m_payloadLength);
-    payload.push_back(m_isCompressed);
-    payload.resize(payload.size() + Size());
-    memcpy(&(*(payload.begin() + 7)), Data(), Size());
+    const uint16_t opcode = (decryptedPayload[0] << 8) | decryptedPayload[1];
 
-    if (m_isCompressed)
+    uint32_t payloadLength;
+    memcpy(&payloadLength, decryptedPayload + sizeof(opcode), sizeof(payloadLength));
+    payloadLength = ntohl(payloadLength);
+
+    // Opcode, payload length and compression flag.
+    const size_t headerLength = sizeof(opcode) + sizeof(payloadLength) + 1;
+    if (payloadLength == 0)
     {
-        // TODO: compress packet
+        reader = PacketReader(opcode, decryptedPayload + headerLength, 0);
+        return true;
     }
 
-    std::vector<uint8_t> iv;
-    uint16_t spi;
-    uint32_t sequenceNumber;
-    std::vector<uint8_t> encryptedPayload = sa->EncryptData(payload, iv, spi, sequenceNumber);
+    const bool isCompressed = decryptedPayload[6];
+    if (!isCompressed)
+    {
+        // The rest is padding.
+        if (payloadLength > encryptedLength - headerLength)
+        {
+            spdlog::error("Packet::Decode: Error: payload length {0} goes past the end of the packet.", payloadLength);
+            return false;
+        }
+
+        reader = PacketReader(opcode, decryptedPayload + headerLength, payloadLength);
+        return true;
+    }
 
-    memcpy(m_packetHeader.IV, &(*iv.begin()), sizeof(m_packetHeader.IV));
-    m_packetHeader.Spi = spi;
-    m_packetHeader.SequenceNumber = sequenceNumber;
+    if (encryptedLength < 14)
+    {
+        spdlog::error("Packet::Decode: Error: compressed packet doesn't have enough data.");
+        return false;
+    }
 
-    m_packetHeader.Size = sizeof(m_packetHeader) + encryptedPayload.size() + sizeof(m_packetAuthentication);
+    uint32_t decompressedPayloadSize =
+            decryptedPayload[10] << 24 |
+            decryptedPayload[9] << 16 |
+            decryptedPayload[8] << 8 |
+            decryptedPayload[7];
 
-    std::vector<uint8_t> data(sizeof(m_packetHeader));
-    memcpy(&(*data.begin()), &m_packetHeader, sizeof(m_packetHeader));
+    if (decompressedPayloadSize > MAX_DECOMPRESSED_PAYLOAD_SIZE)
+    {
+        spdlog::error("Packet::Decode: Error: decompressed payload size {0} is too large.", decompressedPayloadSize);
+        return false;
+    }
+
+    std::vector<uint8_t> compressedPayload {decryptedPayload + 11, decryptedPayload + encryptedLength - 3};
+    t_decompressedPayload = Compressor::DecompressData(compressedPayload, decompressedPayloadSize);
+
+    // DecompressData logged why.
+    if (t_decompressedPayload.size() != decompressedPayloadSize)
+        return false;
+
+    reader = PacketReader(opcode, t_decompressedPayload.data(), (uint32_t) t_decompressedPayload.size());
+    return true;
+}
 
-    data.insert(data.end(), encryptedPayload.begin(), encryptedPayload.end());
+std::vector<uint8_t> Packet::GetDataToSend(const std::shared_ptr<SecurityAssociation>& sa) const
+{
+    const size_t plaintextLength = PAYLOAD_HEADER_SIZE + Size();
+    std::vector<uint8_t> frame = AllocateFrame(plaintextLength);
+    WritePlaintext(frame.data() + sizeof(PacketHeader));
 
-    std::vector<uint8_t> hmac = sa->GetHmac({data.begin() + 2, data.end() });
+    if (!SealFrame(frame, plaintextLength, sa))
+        return std::vector<uint8_t>();
 
-    data.resize(data.size() + 10);
-    memcpy(&(*(data.end() - 10)), hmac.data(), hmac.size());
+    return frame;
+}
 
-    return data;
+std::vector<uint8_t> Packet::Serialize() const
+{
+    std::vector<uint8_t> plaintext(PAYLOAD_HEADER_SIZE + Size());
+    WritePlaintext(plaintext.data());
+    return plaintext;
 }
 
-void Packet::ReadPayload(const std::vector<uint8_t>& packetData, const std::shared_ptr<SecurityAssociation>& sa)
+std::vector<uint8_t> Packet::Seal(const std::vector<uint8_t>& plaintext, const std::shared_ptr<SecurityAssociation>& sa)
 {
-    std::vector<uint8_t> encryptedPayload(packetData.begin() + sizeof(m_packetHeader), packetData.end() - sizeof(m_packetAuthentication));
-    std::vector<uint8_t> decryptedPayload = sa->DecryptData(encryptedPayload, m_packetHeader.IV);
+    std::vector<uint8_t> frame = AllocateFrame(plaintext.size());
+    memcpy(frame.data() + sizeof(PacketHeader), plaintext.data(), plaintext.size());
 
-    m_opcode = (decryptedPayload[0] << 8) | decryptedPayload[1];
+    if (!SealFrame(frame, plaintext.size(), sa))
+        return std::vector<uint8_t>();
 
-    memcpy(&m_payloadLength, &(*(decryptedPayload.begin() + sizeof(m_opcode))), sizeof(m_payloadLength));
-    m_payloadLength = ntohl(m_payloadLength);
+    return frame;
+}
 
-    if (m_payloadLength == 0)
-        return;
+void Packet::WritePlaintext(uint8_t* output) const
+{
+    const uint32_t payloadLength = Size();
+    output[0] = m_opcode >> 8;
+    output[1] = m_opcode;
+    output[2] = payloadLength >> 24;
+    output[3] = payloadLength >> 16;
+    output[4] = payloadLength >> 8;
+    output[5] = payloadLength;
+    output[6] = m_isCompressed;
+
+    if (payloadLength)
+        memcpy(output + PAYLOAD_HEADER_SIZE, Data(), payloadLength);
 
-    m_isCompressed = decryptedPayload[6];
-    if (!m_isCompressed)
-        Append(std::vector<uint8_t> {decryptedPayload.begin() + sizeof(m_opcode) + sizeof(m_payloadLength) + sizeof(m_isCompressed), decryptedPayload.end()});
-    else
+    if (m_isCompressed)
     {
-        uint32_t decompressedPayloadSize =
-                decryptedPayload[10] << 24 |
-                decryptedPayload[9] << 16 |
-                decryptedPayload[8] << 8 |
-                decryptedPayload[7];
-
-        std::vector<uint8_t> compressedPayload {decryptedPayload.begin() + 11, decryptedPayload.end() - 3};
-        std::vector<uint8_t> decompressedPayload = Compressor::DecompressData(compressedPayload, decompressedPayloadSize);
-        Append(decompressedPayload);
-        m_payloadLength = decryptedPayload.size();
+        // TODO: compress packet
     }
 }
 
+std::vector<uint8_t> Packet::AllocateFrame(size_t plaintextLength)
+{
+    return std::vector<uint8_t>(sizeof(PacketHeader) + CryptoHandler::GetPaddedLength(plaintextLength) +
+                                sizeof(PacketAuthentication));
+}
+
+bool Packet::SealFrame(std::vector<uint8_t>& frame, size_t plaintextLength, const std::shared_ptr<SecurityAssociation>& sa)
+{
+    uint8_t* payload = frame.data() + sizeof(PacketHeader);
+    const size_t encryptedLength = frame.size() - sizeof(PacketHeader) - sizeof(PacketAuthentication);
+    CryptoHandler::PadData(payload, plaintextLength, encryptedLength);
+
+    PacketHeader packetHeader {};
+    uint16_t spi;
+    uint32_t sequenceNumber;
+    if (!sa->EncryptData(payload, encryptedLength, packetHeader.IV, spi, sequenceNumber))
+        return false;
+
+    packetHeader.Size = frame.size();
+    packetHeader.Spi = spi;
+    packetHeader.SequenceNumber = sequenceNumber;
+    memcpy(frame.data(), &packetHeader, sizeof(packetHeader));
+
+    // The ICV covers everything but the size and itself.
+    uint8_t* icv = frame.data() + frame.size() - sizeof(PacketAuthentication);
+    return sa->GetHmac(frame.data() + sizeof(packetHeader.Size), icv - frame.data() - sizeof(packetHeader.Size), icv);
+}
+
 std::vector<uint8_t> Packet::GetPayloadData()
 {
     return m_storage;
@@ -20,6 +20,9 @@
 #include "../crypto/AuthHandler.h"
 #include "../crypto/CryptoHandler.h"
 #include "../crypto/SecurityAssociation.h"
+#include "PacketReader.h"
+#include "PacketSchema.h"
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 
@@ -41,7 +44,7 @@ private:
 
     struct PacketAuthentication
     {
-        uint8_t ICV[10];
+        uint8_t ICV[AuthHandler::ICV_SIZE];
     };
 #if defined( __GNUC__ )
 #pragma pack()
@@ -50,34 +53,63 @@ private:
 #endif
 
 public:
+    // Serialized, not yet encrypted packet, shared between the recipients of a broadcast.
+    typedef std::shared_ptr<const std::vector<uint8_t>> SharedPlaintext;
+
     // Empty packet container
     Packet() : ByteBuffer(0)
     {
     }
 
-    explicit Packet(uint8_t opcode, bool isCompressed, size_t reservedSize = 200) : m_opcode(opcode), m_isCompressed(isCompressed), ByteBuffer(reservedSize)
+    explicit Packet(uint16_t opcode, bool isCompressed, size_t reservedSize = 200) : m_opcode(opcode), m_isCompressed(isCompressed), ByteBuffer(reservedSize)
+    {
+    }
+
+    // Packet carrying a message declared with PacketSchema, encoded into a payload allocated at its exact size.
+    template <PacketSchema::Message T>
+    static Packet Create(const T& message)
     {
+        Packet packet(T::OPCODE, false, 0);
+        packet.Resize(PacketSchema::GetSize(message));
+        PacketSchema::Encode(message, packet.m_storage.data());
+        return packet;
     }
 
-    bool LoadData(const std::vector<uint8_t>& data, const std::shared_ptr<SecurityAssociation>& sa);
+    // Owning copy of the whole payload of a received packet, for whatever has to keep it (see PacketReader).
+    explicit Packet(const PacketReader& reader);
 
-    std::vector<uint8_t> GetDataToSend(const std::shared_ptr<SecurityAssociation>& sa);
+    // Decrypts a received frame (header, payload, ICV) and points reader at its payload. Nothing is allocated: the
+    // payload is decrypted into a buffer the calling thread keeps for the next frames.
+    static bool Decode(const uint8_t* frame, size_t length, const std::shared_ptr<SecurityAssociation>& sa, PacketReader& reader);
+
+    // Builds the frame to send in a single buffer, which the caller then moves into the send queue. Returns an empty
+    // frame if it couldn't be sealed.
+    std::vector<uint8_t> GetDataToSend(const std::shared_ptr<SecurityAssociation>& sa) const;
+
+    // GetDataToSend in two steps: the packet is serialized once, then sealed (encrypted and authenticated) with the
+    // Security Association of each connection it goes to.
+    std::vector<uint8_t> Serialize() const;
+    static std::vector<uint8_t> Seal(const std::vector<uint8_t>& plaintext, const std::shared_ptr<SecurityAssociation>& sa);
     std::vector<uint8_t> GetPayloadData();
 
     uint16_t GetOpcode() const;
     uint32_t GetPayloadLength() const;
 
 private:
-    void ReadPayload(const std::vector<uint8_t>& packetData, const std::shared_ptr<SecurityAssociation>& sa);
+    // Opcode, payload length and compression flag, written in front of the payload.
+    static constexpr size_t PAYLOAD_HEADER_SIZE = 7;
 
-    PacketHeader m_packetHeader {};
+    void WritePlaintext(uint8_t* output) const;
+
+    // A frame is allocated at its final size, with room for the header in front of the plaintext and for the padding
+    // and the ICV after it. Sealing then fills these in, encrypting the plaintext where it is.
+    static std::vector<uint8_t> AllocateFrame(size_t plaintextLength);
+    static bool SealFrame(std::vector<uint8_t>& frame, size_t plaintextLength, const std::shared_ptr<SecurityAssociation>& sa);
 
     // Packet Payload
     uint16_t m_opcode = 0;
     uint32_t m_payloadLength = 0;
     bool m_isCompressed = false;
-
-    PacketAuthentication m_packetAuthentication {};
 };
 
 #endif //GCEMU_PACKET_H
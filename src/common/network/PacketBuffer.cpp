@@ -14,16 +14,66 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "PacketBuffer.h"
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
-PacketBuffer::PacketBuffer(int32_t initialSize) : m_buffer(initialSize, 0)
+PacketBuffer::PacketBuffer(std::shared_ptr<BufferPool> pool) : m_pool(std::move(pool))
 {
 }
 
-uint8_t PacketBuffer::Peek() const
+PacketBuffer::~PacketBuffer()
 {
-    return m_buffer[m_readPosition];
+    ReleaseStorage();
+}
+
+void PacketBuffer::SetCapacity(size_t capacity)
+{
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    assert(capacity >= ReadLengthRemaining());
+
+    uint8_t* storage = m_pool ? m_pool->Allocate(capacity) : static_cast<uint8_t*>(::operator new(capacity));
+
+    // Pending data is moved to the start of the new storage.
+    const size_t pending = ReadLengthRemaining();
+    if (pending)
+        Read(reinterpret_cast<char*>(storage), pending);
+
+    ReleaseStorage();
+
+    m_storage = storage;
+    m_capacity = capacity;
+    m_mask = capacity - 1;
+    m_readPosition = 0;
+    m_writePosition = pending;
+}
+
+void PacketBuffer::ReleaseStorage()
+{
+    if (!m_storage)
+        return;
+
+    if (m_pool)
+        m_pool->Deallocate(m_storage, m_capacity);
+    else
+        ::operator delete(m_storage);
+
+    m_storage = nullptr;
+    m_capacity = 0;
+    m_mask = 0;
+    m_readPosition = m_writePosition = 0;
+}
+
+uint8_t PacketBuffer::Peek(size_t offset) const
+{
+    assert(offset < ReadLengthRemaining());
+
+    return m_storage[(m_readPosition + offset) & m_mask];
+}
+
+size_t PacketBuffer::Capacity() const
+{
+    return m_capacity;
 }
 
 size_t PacketBuffer::ReadLengthRemaining() const
@@ -31,25 +81,72 @@ size_t PacketBuffer::ReadLengthRemaining() const
     return m_writePosition - m_readPosition;
 }
 
-void PacketBuffer::Read(char *buffer, int32_t length)
+size_t PacketBuffer::WriteLengthRemaining() const
+{
+    return Capacity() - ReadLengthRemaining();
+}
+
+void PacketBuffer::Read(char *buffer, size_t length)
 {
     assert(ReadLengthRemaining() >= length);
 
     if (buffer)
-        memcpy(buffer, &m_buffer[m_readPosition], length);
+    {
+        const size_t start = m_readPosition & m_mask;
+        const size_t firstLength = std::min(length, Capacity() - start);
+        memcpy(buffer, &m_storage[start], firstLength);
+        memcpy(buffer + firstLength, &m_storage[0], length - firstLength);
+    }
 
     m_readPosition += length;
+
+    // Once everything has been consumed, start over from the beginning of the storage so the next frames are less
+    // likely to wrap around.
+    if (m_readPosition == m_writePosition)
+        m_readPosition = m_writePosition = 0;
 }
 
-void PacketBuffer::Write(const char *buffer, int32_t length)
+void PacketBuffer::Write(const char *buffer, size_t length)
 {
     assert(buffer != nullptr && length != 0);
+    assert(WriteLengthRemaining() >= length);
+
+    const size_t start = m_writePosition & m_mask;
+    const size_t firstLength = std::min(length, Capacity() - start);
+    memcpy(&m_storage[start], buffer, firstLength);
+    memcpy(&m_storage[0], buffer + firstLength, length - firstLength);
 
-    const size_t newLength = m_writePosition + length;
+    m_writePosition += length;
+}
+
+const uint8_t* PacketBuffer::GetReadView(size_t length, std::vector<uint8_t>& scratch) const
+{
+    assert(ReadLengthRemaining() >= length);
 
-    if (m_buffer.size() < newLength)
-        m_buffer.resize(newLength);
+    const size_t start = m_readPosition & m_mask;
+    if (start + length <= Capacity())
+        return &m_storage[start];
+
+    const size_t firstLength = Capacity() - start;
+    scratch.resize(length);
+    memcpy(scratch.data(), &m_storage[start], firstLength);
+    memcpy(scratch.data() + firstLength, &m_storage[0], length - firstLength);
+
+    return scratch.data();
+}
+
+std::array<boost::asio::mutable_buffer, 2> PacketBuffer::GetWriteBuffers()
+{
+    const size_t free = WriteLengthRemaining();
+    const size_t start = m_writePosition & m_mask;
+    const size_t firstLength = std::min(free, Capacity() - start);
+
+    return { boost::asio::buffer(&m_storage[start], firstLength), boost::asio::buffer(&m_storage[0], free - firstLength) };
+}
+
+void PacketBuffer::CommitWrite(size_t length)
+{
+    assert(WriteLengthRemaining() >= length);
 
-    memcpy(&m_buffer[m_writePosition], buffer, length);
     m_writePosition += length;
 }
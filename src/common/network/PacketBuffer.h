@@ -16,30 +16,61 @@
 #ifndef GCEMU_PACKETBUFFER_H
 #define GCEMU_PACKETBUFFER_H
 
+#include "BufferPool.h"
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
+#include <boost/asio/buffer.hpp>
 
-#define DEFAULT_BUFFER_SIZE 6144
+// Must be a power of two. Receive buffers start at this size and grow on demand (see network_receive_buffer_initial).
+#define DEFAULT_BUFFER_SIZE 1024
 
+// Ring buffer. The read and write positions only ever grow and are masked into the storage, so
+// consuming data never moves the bytes that are still pending. The storage comes from a BufferPool when one is given.
 class PacketBuffer
 {
     friend class Socket;
 
 public:
-    explicit PacketBuffer(int32_t initialSize = DEFAULT_BUFFER_SIZE);
+    explicit PacketBuffer(std::shared_ptr<BufferPool> pool = nullptr);
+    ~PacketBuffer();
 
-    uint8_t Peek() const;
+    PacketBuffer(const PacketBuffer&) = delete;
+    PacketBuffer& operator=(const PacketBuffer&) = delete;
 
+    // (Re)allocates the storage, keeping any pending data. The capacity must be a power of two.
+    void SetCapacity(size_t capacity);
+
+    uint8_t Peek(size_t offset = 0) const;
+
+    size_t Capacity() const;
     size_t ReadLengthRemaining() const;
+    size_t WriteLengthRemaining() const;
+
+    void Read(char* buffer, size_t length);
+    void Write(const char* buffer, size_t length);
 
-    void Read(char* buffer, int32_t length);
-    void Write(const char* buffer, int32_t length);
+    // Returns a pointer to the next length readable bytes without consuming them. The data is only copied (into
+    // scratch) when it wraps around the end of the storage.
+    const uint8_t* GetReadView(size_t length, std::vector<uint8_t>& scratch) const;
 
 private:
+    // Free space as (at most) two segments: up to the end of the storage, then from its start.
+    std::array<boost::asio::mutable_buffer, 2> GetWriteBuffers();
+    void CommitWrite(size_t length);
+
+    // Frees the storage, dropping any pending data. The buffer can't be used again until SetCapacity is called.
+    void ReleaseStorage();
+
     size_t m_writePosition = 0;
     size_t m_readPosition = 0;
+    size_t m_mask = 0;
 
-    std::vector<uint8_t> m_buffer;
+    uint8_t* m_storage = nullptr;
+    size_t m_capacity = 0;
+    std::shared_ptr<BufferPool> m_pool;
 };
 
 #endif //GCEMU_PACKETBUFFER_H
@@ -0,0 +1,69 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_PACKETREADER_H
+#define GCEMU_PACKETREADER_H
+
+#include "../util/ByteReader.h"
+#include <cstdint>
+
+// Non-owning view over the payload of a received packet (see Packet::Decode), read the same way as a Packet (see
+// ByteReader). The payload lives in memory owned by the thread that decoded it, and is only valid until that thread
+// decodes the next packet: whatever has to outlive that, such as a handler that gets suspended, takes an owning Packet
+// instead.
+class PacketReader : public ByteReader<PacketReader>
+{
+public:
+    PacketReader() = default;
+
+    PacketReader(uint16_t opcode, const uint8_t* payload, uint32_t payloadLength) : m_opcode(opcode), m_payload(payload),
+                                                                                   m_payloadLength(payloadLength)
+    {
+    }
+
+    uint16_t GetOpcode() const
+    {
+        return m_opcode;
+    }
+
+    uint32_t GetPayloadLength() const
+    {
+        return m_payloadLength;
+    }
+
+    const uint8_t* GetPayload() const
+    {
+        return m_payload;
+    }
+
+private:
+    friend class ByteReader<PacketReader>;
+
+    const uint8_t* GetReadData() const
+    {
+        return m_payload;
+    }
+
+    size_t GetReadSize() const
+    {
+        return m_payloadLength;
+    }
+
+    uint16_t m_opcode = 0;
+    const uint8_t* m_payload = nullptr;
+    uint32_t m_payloadLength = 0;
+};
+
+#endif //GCEMU_PACKETREADER_H
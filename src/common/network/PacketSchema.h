@@ -0,0 +1,250 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_PACKETSCHEMA_H
+#define GCEMU_PACKETSCHEMA_H
+
+#include "../util/ByteConverter.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// Declarative packet layouts. A message is a struct listing its fields, in wire order, as a tuple of member pointers:
+//
+//     struct Example
+//     {
+//         uint32_t Id;
+//         std::string Name;
+//
+//         static constexpr auto Fields = std::make_tuple(&Example::Id, &Example::Name);
+//     };
+//
+// Everything else is generated from that list: the exact encoded size, the encoder, the decoder and the minimum size
+// a payload must have to hold the message. Fields are written the way ByteBuffer writes them:
+// - integers, floating point numbers and enums in big-endian order;
+// - strings and byte vectors as their length in bytes (a uint32_t) followed by the bytes, UTF-16 strings in host order
+//   (their length has to be even);
+// - messages (structs with their own Fields) inline, one field after the other.
+namespace PacketSchema
+{
+    template <typename T>
+    concept Message = requires { T::Fields; };
+
+    // Wire form of one field type. Decode returns false when the bytes read can't be a value of the type; running out of
+    // bytes is left to the reader (see ByteReader::HasUnderflow).
+    template <typename T>
+    struct Field;
+
+    template <typename T> requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+    struct Field<T>
+    {
+        static constexpr size_t MIN_SIZE = sizeof(T);
+        static constexpr bool FIXED_SIZE = true;
+
+        static size_t GetSize(const T&)
+        {
+            return sizeof(T);
+        }
+
+        static uint8_t* Encode(T value, uint8_t* output)
+        {
+            EndianConvertReverse(value);
+            memcpy(output, &value, sizeof(T));
+            return output + sizeof(T);
+        }
+
+        template <typename Reader>
+        static bool Decode(Reader& reader, T& value)
+        {
+            value = reader.template Read<T>();
+            return true;
+        }
+
+        template <typename Reader>
+        static void DecodeUnchecked(Reader& reader, T& value)
+        {
+            value = reader.template ReadUnchecked<T>();
+        }
+    };
+
+    // Strings and byte vectors, behind their length.
+    template <typename T> requires std::is_same_v<T, std::string> || std::is_same_v<T, std::u16string> ||
+                                   std::is_same_v<T, std::vector<uint8_t>>
+    struct Field<T>
+    {
+        static constexpr size_t MIN_SIZE = sizeof(uint32_t);
+        static constexpr bool FIXED_SIZE = false;
+
+        static size_t GetSize(const T& value)
+        {
+            return sizeof(uint32_t) + value.size() * sizeof(typename T::value_type);
+        }
+
+        static uint8_t* Encode(const T& value, uint8_t* output)
+        {
+            const uint32_t length = value.size() * sizeof(typename T::value_type);
+            output = Field<uint32_t>::Encode(length, output);
+            if (length)
+                memcpy(output, value.data(), length);
+
+            return output + length;
+        }
+
+        template <typename Reader>
+        static bool Decode(Reader& reader, T& value)
+        {
+            const uint32_t length = reader.template Read<uint32_t>();
+            const std::span<const uint8_t> data = reader.ReadSpan(length);
+
+            // A UTF-16 string can't end half way through a character.
+            if (data.size() % sizeof(typename T::value_type))
+                return false;
+
+            value.resize(data.size() / sizeof(typename T::value_type));
+            if (!value.empty())
+                memcpy(value.data(), data.data(), data.size());
+
+            return true;
+        }
+    };
+
+    namespace Detail
+    {
+        template <typename>
+        struct MemberOf;
+
+        template <typename Class, typename Member>
+        struct MemberOf<Member Class::*>
+        {
+            using Type = Member;
+        };
+
+        template <typename Pointer>
+        using FieldOf = Field<typename MemberOf<std::remove_cvref_t<Pointer>>::Type>;
+    }
+
+    template <Message T>
+    struct Field<T>
+    {
+        static constexpr size_t MIN_SIZE = std::apply([] (auto... members)
+        {
+            return (Detail::FieldOf<decltype(members)>::MIN_SIZE + ... + 0);
+        }, T::Fields);
+
+        static constexpr bool FIXED_SIZE = std::apply([] (auto... members)
+        {
+            return (Detail::FieldOf<decltype(members)>::FIXED_SIZE && ... && true);
+        }, T::Fields);
+
+        static size_t GetSize(const T& message)
+        {
+            // Folds to a constant for messages made of fixed size fields only.
+            if constexpr (FIXED_SIZE)
+                return MIN_SIZE;
+
+            return std::apply([&message] (auto... members)
+            {
+                return (Detail::FieldOf<decltype(members)>::GetSize(message.*members) + ... + 0);
+            }, T::Fields);
+        }
+
+        static uint8_t* Encode(const T& message, uint8_t* output)
+        {
+            std::apply([&message, &output] (auto... members)
+            {
+                ((output = Detail::FieldOf<decltype(members)>::Encode(message.*members, output)), ...);
+            }, T::Fields);
+
+            return output;
+        }
+
+        // Stops at the first field that fails.
+        template <typename Reader>
+        static bool Decode(Reader& reader, T& message)
+        {
+            return std::apply([&reader, &message] (auto... members)
+            {
+                return (Detail::FieldOf<decltype(members)>::Decode(reader, message.*members) && ... && true);
+            }, T::Fields);
+        }
+
+        template <typename Reader> requires FIXED_SIZE
+        static void DecodeUnchecked(Reader& reader, T& message)
+        {
+            std::apply([&reader, &message] (auto... members)
+            {
+                (Detail::FieldOf<decltype(members)>::DecodeUnchecked(reader, message.*members), ...);
+            }, T::Fields);
+        }
+    };
+
+    // Smallest payload that can hold a T, i.e. its size with every string and vector empty. For messages made of fixed
+    // size fields only, this is their exact size.
+    template <Message T>
+    constexpr size_t MIN_SIZE = Field<T>::MIN_SIZE;
+
+    template <Message T>
+    constexpr bool FIXED_SIZE = Field<T>::FIXED_SIZE;
+
+    template <Message T>
+    size_t GetSize(const T& message)
+    {
+        return Field<T>::GetSize(message);
+    }
+
+    // Writes the message to output, which must hold GetSize(message) bytes, and returns the end of what was written.
+    template <Message T>
+    uint8_t* Encode(const T& message, uint8_t* output)
+    {
+        return Field<T>::Encode(message, output);
+    }
+
+    template <Message T>
+    std::vector<uint8_t> Encode(const T& message)
+    {
+        std::vector<uint8_t> data(GetSize(message));
+        Encode(message, data.data());
+        return data;
+    }
+
+    // Reads a message from a ByteReader (a Packet or a PacketReader). Returns false when the payload is too short for
+    // it or holds a malformed field (a UTF-16 string of an odd length), in which case the message is only partially
+    // read. Payloads shorter than MIN_SIZE are rejected before
+    // reading anything, after which fixed size messages are read without further bounds checks.
+    template <Message T, typename Reader>
+    bool Decode(Reader& reader, T& message)
+    {
+        if (reader.GetReadLengthRemaining() < MIN_SIZE<T>)
+            return false;
+
+        if constexpr (FIXED_SIZE<T>)
+            Field<T>::DecodeUnchecked(reader, message);
+        else
+        {
+            const bool decoded = Field<T>::Decode(reader, message);
+            if (!decoded)
+                return false;
+        }
+
+        return !reader.HasUnderflow();
+    }
+}
+
+#endif //GCEMU_PACKETSCHEMA_H
@@ -14,14 +14,39 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "Socket.h"
+#include "NetworkConfig.h"
+#include "NetworkStats.h"
+#include <algorithm>
+#include <cassert>
 #include <memory>
 #include <boost/lexical_cast.hpp>
 #include <spdlog/spdlog.h>
 
-Socket::Socket(boost::asio::io_context &ioContext, const std::function<void(Socket *)>& closeHandler) : m_socket(ioContext)
+Socket::Socket(NetworkContext& context, const std::function<void(Socket *)>& closeHandler) : m_context(&context),
+                                                                                          m_socket(context.GetIoContext()),
+                                                                                          m_closeHandler(closeHandler),
+                                                                                          m_inBuffer(context.GetBufferPool()),
+                                                                                          m_frameDecoder(SNetworkConfig.GetMaxFrameSize())
 {
 }
 
+Socket::~Socket()
+{
+    SAdmissionControl.Release(m_admissionSlot);
+}
+
+bool Socket::Admit()
+{
+    boost::system::error_code ec;
+    const boost::asio::ip::tcp::endpoint endpoint = m_socket.remote_endpoint(ec);
+    if (!ec && SAdmissionControl.Admit(endpoint.address(), m_admissionSlot))
+        return true;
+
+    // Never registered anywhere, so there is nothing to tell the close handler.
+    m_socket.close(ec);
+    return false;
+}
+
 bool Socket::Open()
 {
     try
@@ -37,8 +62,22 @@ bool Socket::Open()
         return false;
     }
 
-    m_outBuffer = std::make_unique<PacketBuffer>();
-    m_inBuffer = std::make_unique<PacketBuffer>();
+    // Reads complete as soon as the socket is readable, and are then finished with a non-blocking read_some.
+    boost::system::error_code ec;
+    m_socket.non_blocking(true, ec);
+    if (ec)
+    {
+        spdlog::error("Socket::Open() failed to make the socket non-blocking. Error: {0}", ec.message());
+        return false;
+    }
+
+    m_lastActivity = std::chrono::steady_clock::now();
+
+    if (SNetworkConfig.GetIdleTimeout().count())
+    {
+        m_idleTimer.SetCallback([this] () { OnIdleTimeout(); });
+        GetContext().GetTimingWheel().Schedule(m_idleTimer, SNetworkConfig.GetIdleTimeout());
+    }
 
     StartAsyncRead();
 
@@ -47,21 +86,212 @@ bool Socket::Open()
 
 void Socket::Close()
 {
-    std::lock_guard<std::mutex> lock(m_closeLock);
-    if (IsClosed())
+    SocketState state = m_state.load(std::memory_order_acquire);
+    do
+    {
+        if (state >= SocketState::Closed)
+            return;
+    }
+    while (!m_state.compare_exchange_weak(state, SocketState::Closed, std::memory_order_acq_rel));
+
+    // Only the first call gets here. The asio socket may only be touched from its own thread, so the teardown runs
+    // there; called from that thread (which is the common case: errors, timeouts, handlers), it runs right away.
+    Teardown();
+}
+
+void Socket::CloseWhenFlushed()
+{
+    if (!RunsInSocketThread())
+    {
+        std::shared_ptr<Socket> ptr = shared<Socket>();
+        GetContext().GetInbox().Push([ptr] () { ptr->CloseWhenFlushed(); });
+        return;
+    }
+
+    SocketState expected = SocketState::Open;
+    if (!m_state.compare_exchange_strong(expected, SocketState::Closing, std::memory_order_acq_rel))
+        return;
+
+    // OnWriteComplete and Flush close the socket once they find it closing with nothing left to send, as does Resume
+    // for a socket that is being migrated.
+    if (m_isWriting || m_flushScheduled || m_migrationTarget)
+    {
+        boost::system::error_code ec;
+        m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_receive, ec);
+        return;
+    }
+
+    Close();
+}
+
+void Socket::Teardown()
+{
+    // Goes through the inbox rather than the asio socket's executor, so a teardown racing with a migration is ordered
+    // after the socket is attached to its new thread (see Migrate).
+    if (!RunsInSocketThread())
+    {
+        std::shared_ptr<Socket> ptr = shared<Socket>();
+        GetContext().GetInbox().Push([ptr] () { ptr->Teardown(); });
         return;
+    }
+
+    m_idleTimer.Cancel();
 
     boost::system::error_code ec;
     m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-    m_socket.close();
+    m_socket.close(ec);
+
+    if (m_corkTimer)
+        m_corkTimer->cancel();
+
+    if (m_writableSignal)
+        m_writableSignal->cancel();
+
+    // Holds a reference to this socket when the close interrupted a migration.
+    m_attach = nullptr;
 
+    SAdmissionControl.Release(m_admissionSlot);
+    m_admissionSlot = AdmissionControl::INVALID_SLOT;
+
+    OnClose();
+
+    // Drops the socket from its NetworkThread, which marks it as reclaimed. Its memory goes back to the pools once the
+    // handlers still pending on it have run.
     if (m_closeHandler)
         m_closeHandler(this);
 }
 
 bool Socket::IsClosed() const
 {
-    return !m_socket.is_open();
+    return m_state.load(std::memory_order_acquire) >= SocketState::Closed;
+}
+
+SocketState Socket::GetState() const
+{
+    return m_state.load(std::memory_order_acquire);
+}
+
+void Socket::SetReclaimed()
+{
+    m_state.store(SocketState::Reclaimed, std::memory_order_release);
+}
+
+uint64_t Socket::GetSessionId() const
+{
+    return m_sessionId;
+}
+
+void Socket::SetSessionId(uint64_t sessionId)
+{
+    m_sessionId = sessionId;
+}
+
+bool Socket::RunsInSocketThread() const
+{
+    return m_context.load(std::memory_order_acquire)->GetIoContext().get_executor().running_in_this_thread();
+}
+
+NetworkContext& Socket::GetContext()
+{
+    return *m_context.load(std::memory_order_acquire);
+}
+
+bool Socket::CanMigrate() const
+{
+    // With nothing pending, the only operation on the socket is the wait for it to become readable. Coroutines stay
+    // on the executor they were started on, so a socket running one has to stay too.
+    return GetState() == SocketState::Open && !m_migrationTarget && m_inBuffer.ReadLengthRemaining() == 0 &&
+           !m_isWriting && !m_flushScheduled && (!m_writeQueue || m_writeQueue->Buffers.empty()) &&
+           !m_runningCoroutines;
+}
+
+void Socket::Migrate(NetworkContext& target, std::function<void()> attach)
+{
+    assert(CanMigrate());
+
+    m_migrationTarget = &target;
+    m_attach = std::move(attach);
+
+    // A timer about to fire still has to be re-armed on the other side.
+    m_idleRemaining = m_idleTimer.IsArmed() ? std::max(GetContext().GetTimingWheel().GetRemaining(m_idleTimer),
+                                                       std::chrono::milliseconds(1)) : std::chrono::milliseconds(0);
+    m_idleTimer.Cancel();
+    OnDetach();
+
+    // Receive buffers come from the pools of the thread serving the socket.
+    m_inBuffer.ReleaseStorage();
+    std::vector<uint8_t>().swap(m_readViewScratch);
+    m_corkTimer.reset();
+    m_writableSignal.reset();
+
+    // Completes the pending wait, which carries on with the migration (see OnReadable).
+    boost::system::error_code ec;
+    m_socket.cancel(ec);
+}
+
+void Socket::Detach()
+{
+    boost::system::error_code ec;
+    m_migratingHandle = m_socket.release(ec);
+    if (ec)
+    {
+        spdlog::error("Socket::Detach: could not release session {0} ({1}): {2}", m_sessionId, m_remoteEndpoint,
+                      ec.message());
+        m_migrationTarget = nullptr;
+        m_attach = nullptr;
+        Close();
+        return;
+    }
+
+    // The attach is queued before the new context is published: whoever sees it hands its work to the new thread
+    // through the same inbox, behind the attach.
+    NetworkContext* target = m_migrationTarget;
+    target->GetInbox().Push(std::move(m_attach));
+    m_attach = nullptr;
+    m_context.store(target, std::memory_order_release);
+}
+
+bool Socket::Attach(const std::function<void(Socket*)>& closeHandler)
+{
+    m_context.store(m_migrationTarget, std::memory_order_release);
+    m_migrationTarget = nullptr;
+    m_closeHandler = closeHandler;
+    m_inBuffer.m_pool = GetContext().GetBufferPool();
+
+    boost::system::error_code ec;
+    m_socket = boost::asio::ip::tcp::socket(GetContext().GetIoContext());
+    m_socket.assign(m_remoteAddress.is_v6() ? boost::asio::ip::tcp::v6() : boost::asio::ip::tcp::v4(), m_migratingHandle, ec);
+    if (!ec)
+        m_socket.non_blocking(true, ec);
+
+    // Closed while on its way here: the teardown already ran, or is queued behind this.
+    if (ec || IsClosed())
+    {
+        m_socket.close(ec);
+        return false;
+    }
+
+    if (m_idleRemaining.count())
+        GetContext().GetTimingWheel().Schedule(m_idleTimer, m_idleRemaining);
+
+    OnAttach();
+    return true;
+}
+
+void Socket::Resume()
+{
+    StartAsyncRead();
+
+    // Data queued while on the move goes out now.
+    if (m_writeQueue && !m_writeQueue->Buffers.empty())
+        StartAsyncWrite();
+    else if (GetState() == SocketState::Closing)
+        Close();
+}
+
+size_t Socket::GetQueuedBytes() const
+{
+    return m_writeQueueBytes;
 }
 
 boost::asio::ip::tcp::socket &Socket::GetAsioSocket()
@@ -71,101 +301,406 @@ boost::asio::ip::tcp::socket &Socket::GetAsioSocket()
 
 void Socket::StartAsyncRead()
 {
-    if (IsClosed())
+    // A closing socket only finishes sending.
+    if (GetState() != SocketState::Open)
         return;
 
     std::shared_ptr<Socket> ptr = shared<Socket>();
-    m_socket.async_read_some(boost::asio::buffer(&m_inBuffer->m_buffer[m_inBuffer->m_writePosition], m_inBuffer->m_buffer.size() - m_inBuffer->m_writePosition),
+
+    // Without a partial frame pending there is no need to hand a buffer to the kernel: wait for the socket to become
+    // readable first, so idle connections can give their receive buffer back in the meantime.
+    if (m_inBuffer.ReadLengthRemaining() == 0)
+    {
+        m_socket.async_wait(boost::asio::ip::tcp::socket::wait_read,
+                            make_custom_alloc_handler(m_allocator, [ptr](const boost::system::error_code& ec) { ptr->OnReadable(ec); }));
+        return;
+    }
+
+    m_socket.async_read_some(m_inBuffer.GetWriteBuffers(),
                              make_custom_alloc_handler(m_allocator, [ptr](const boost::system::error_code& ec, size_t length) { ptr->OnRead(ec, length); }));
 }
 
-void Socket::OnRead(const boost::system::error_code &ec, size_t length)
+void Socket::OnReadable(const boost::system::error_code &ec)
 {
+    // The wait was cancelled to migrate the socket, or was already done by then. Either way nothing was read yet.
+    if (m_migrationTarget && !IsClosed())
+    {
+        Detach();
+        return;
+    }
+
     if (ec)
+    {
+        Close();
         return;
+    }
 
-    if (IsClosed())
+    if (GetState() != SocketState::Open)
         return;
 
-    m_inBuffer->m_writePosition += length;
+    if (m_inBuffer.Capacity() == 0)
+        m_inBuffer.SetCapacity(SNetworkConfig.GetReceiveBufferInitialSize());
 
-    const size_t available = m_socket.available();
-    if (available > 0 && (length + available) > m_inBuffer->m_buffer.size())
+    boost::system::error_code readEc;
+    const size_t length = m_socket.read_some(m_inBuffer.GetWriteBuffers(), readEc);
+    if (readEc == boost::asio::error::would_block || readEc == boost::asio::error::try_again)
     {
-        m_inBuffer->m_buffer.resize(m_inBuffer->m_buffer.size() + available);
         StartAsyncRead();
         return;
     }
 
-    while (m_inBuffer->m_readPosition < m_inBuffer->m_writePosition)
+    OnRead(readEc, length);
+}
+
+void Socket::OnRead(const boost::system::error_code &ec, size_t length)
+{
+    // Includes the peer closing the connection (eof).
+    if (ec)
     {
-        if (ProcessIncomingData())
-            continue;
+        Close();
+        return;
+    }
+
+    if (GetState() != SocketState::Open)
+        return;
 
-        // This errno is set when there is not enough buffer data available to either complete a header, or the packet length
-        // specified in the header goes past what we've read. In this case, we will reset the buffer with the remaining data.
-        if (errno == EBADMSG)
+    m_inBuffer.CommitWrite(length);
+    GetContext().AddBytesTransferred(length);
+    m_lastActivity = std::chrono::steady_clock::now();
+
+    if (m_idleTimer.IsArmed())
+        GetContext().GetTimingWheel().Schedule(m_idleTimer, SNetworkConfig.GetIdleTimeout());
+
+    // A read that fills the whole buffer suggests the peer is sending more than it can hold at once.
+    if (m_inBuffer.WriteLengthRemaining() == 0)
+        GrowReceiveBuffer();
+
+    // Handlers may close the socket, in which case whatever is left is dropped.
+    while (GetState() == SocketState::Open)
+    {
+        const uint8_t* frame;
+        size_t frameLength;
+        const FrameDecoder::Result result = m_frameDecoder.Next(m_inBuffer, m_readViewScratch, frame, frameLength);
+
+        if (result == FrameDecoder::Result::Frame)
         {
-            const size_t bytesRemaining = m_inBuffer->m_writePosition - m_inBuffer->m_readPosition;
-            std::memmove(&m_inBuffer->m_buffer[0], &m_inBuffer->m_buffer[m_inBuffer->m_readPosition], bytesRemaining);
-            m_inBuffer->m_readPosition = 0;
-            m_inBuffer->m_writePosition = bytesRemaining;
+            if (!ProcessFrame(frame, frameLength))
+                Close();
 
-            StartAsyncRead();
+            continue;
         }
-        else if (!IsClosed())
+
+        if (result == FrameDecoder::Result::Invalid)
+        {
+            spdlog::error("Socket::OnRead: session {0} ({1}) announced an invalid frame size of {2} bytes (max {3}).",
+                          m_sessionId, m_remoteEndpoint, m_frameDecoder.GetFrameSize(), m_frameDecoder.GetMaxFrameSize());
             Close();
+            return;
+        }
 
-        return;
-    }
+        // The start of the next frame stays in the ring buffer until the rest of it arrives. Frames are never larger
+        // than the max buffer size (see network_max_frame_size), so a full buffer only has to grow.
+        if (m_inBuffer.WriteLengthRemaining() == 0 && !GrowReceiveBuffer())
+        {
+            spdlog::error("Socket::OnRead: frame from session {0} ({1}) does not fit in the receive buffer.", m_sessionId,
+                          m_remoteEndpoint);
+            Close();
+            return;
+        }
 
-    m_inBuffer->m_writePosition = m_inBuffer->m_readPosition = 0;
+        break;
+    }
 
     StartAsyncRead();
 }
 
-size_t Socket::ReadLengthRemaining() const
+void Socket::OnIdleTimeout()
 {
-    return m_inBuffer->ReadLengthRemaining();
+    // Closing drops the socket from its table, which may be the last reference to it.
+    std::shared_ptr<Socket> ptr = shared<Socket>();
+
+    if (IsClosed())
+        return;
+
+    spdlog::info("Socket::OnIdleTimeout: nothing received from session {0} ({1}) for {2} ms, closing it.", m_sessionId,
+                 m_remoteEndpoint, SNetworkConfig.GetIdleTimeout().count());
+    Close();
 }
 
-void Socket::Write(const char *buffer, int32_t length)
+bool Socket::GrowReceiveBuffer()
 {
-    PacketBuffer* outBuffer = m_outBuffer.get();
+    if (m_inBuffer.Capacity() >= SNetworkConfig.GetReceiveBufferMaxSize())
+        return false;
 
-    outBuffer->Write(buffer, length);
+    m_inBuffer.SetCapacity(m_inBuffer.Capacity() * 2);
+    return true;
+}
 
-    if (IsClosed())
+void Socket::ReleaseIdleMemory(std::chrono::steady_clock::time_point idleSince)
+{
+    if (IsClosed() || m_lastActivity > idleSince)
         return;
 
+    // Only an empty buffer can go: it is not referenced by the pending read (see StartAsyncRead) and holds no data.
+    if (m_inBuffer.Capacity() && m_inBuffer.ReadLengthRemaining() == 0)
+        m_inBuffer.ReleaseStorage();
+
+    std::vector<uint8_t>().swap(m_readViewScratch);
+
+    if (m_writeQueue && !m_isWriting && !m_flushScheduled && m_writeQueue->Buffers.empty())
+        m_writeQueue.reset();
+}
+
+size_t Socket::GetMemoryUsage()
+{
+    size_t usage = sizeof(*this) + m_inBuffer.Capacity() + m_readViewScratch.capacity();
+    if (m_writeQueue)
+        usage += sizeof(WriteQueue) + m_writeQueueBytes + m_writeQueue->InFlight.capacity() * sizeof(boost::asio::const_buffer);
+
+    return usage;
+}
+
+size_t Socket::ReadLengthRemaining() const
+{
+    return m_inBuffer.ReadLengthRemaining();
+}
+
+bool Socket::Write(const char *buffer, int32_t length, bool critical)
+{
+    assert(buffer != nullptr && length > 0);
+
+    return Write(std::vector<uint8_t>(buffer, buffer + length), critical);
+}
+
+bool Socket::Write(std::vector<uint8_t>&& buffer, bool critical)
+{
+    if (buffer.empty() || IsClosed())
+        return false;
+
+    if (!RunsInSocketThread())
+    {
+        std::shared_ptr<Socket> ptr = shared<Socket>();
+        GetContext().GetInbox().Push([ptr, buffer = std::move(buffer), critical] () mutable
+        {
+            ptr->Write(std::move(buffer), critical);
+        });
+
+        return true;
+    }
+
+    const size_t queuedBytes = m_writeQueueBytes + buffer.size();
+    if (queuedBytes > SNetworkConfig.GetSendQueueHighWatermark() && !m_writeBackpressured)
+    {
+        m_writeBackpressured = true;
+        NetworkStats::Increment(SNetworkStats.SendQueueOverflows);
+    }
+
+    if (m_writeBackpressured)
+    {
+        if (SNetworkConfig.GetSendQueueOverflowPolicy() == SendQueueOverflowPolicy::Disconnect ||
+            queuedBytes > SNetworkConfig.GetSendQueueMaxBytes())
+        {
+            spdlog::error("Socket::Write: session {0} ({1}) is not reading its data, {2} bytes queued. Disconnecting.",
+                          m_sessionId, m_remoteEndpoint, queuedBytes - buffer.size());
+            NetworkStats::Increment(SNetworkStats.SlowConsumerDisconnects);
+            Close();
+            return false;
+        }
+
+        if (!critical)
+        {
+            NetworkStats::Increment(SNetworkStats.PacketsDropped);
+            return false;
+        }
+    }
+
+    m_writeQueueBytes = queuedBytes;
+    if (!m_writeQueue)
+        m_writeQueue = std::make_unique<WriteQueue>();
+
+    m_writeQueue->Buffers.push_back(std::move(buffer));
+    NetworkStats::Increment(SNetworkStats.BuffersQueued);
+
+    // A write in flight will pick up the new buffer when it completes, and a socket on the move sends it once attached.
+    if (m_isWriting || m_migrationTarget)
+        return true;
+
+    if (!SNetworkConfig.IsCorkEnabled() || m_writeQueueBytes >= SNetworkConfig.GetCorkMaxBytes())
+        StartAsyncWrite();
+    else
+        ScheduleFlush();
+
+    return true;
+}
+
+bool Socket::IsWriteBackpressured() const
+{
+    return m_writeBackpressured.load(std::memory_order_relaxed);
+}
+
+void Socket::Spawn(boost::asio::awaitable<void> coroutine)
+{
+    assert(RunsInSocketThread());
+
+    m_runningCoroutines++;
+
     std::shared_ptr<Socket> ptr = shared<Socket>();
-    m_socket.async_write_some(boost::asio::buffer(m_outBuffer->m_buffer, m_outBuffer->m_writePosition),
-                              make_custom_alloc_handler(m_allocator, [ptr](const boost::system::error_code& ec, size_t length)
-                              { ptr->OnWriteComplete(ec, length); }));
+    boost::asio::co_spawn(m_socket.get_executor(), std::move(coroutine), [ptr] (std::exception_ptr exception)
+    {
+        ptr->m_runningCoroutines--;
+        if (!exception)
+            return;
+
+        try
+        {
+            std::rethrow_exception(exception);
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::error("Socket::Spawn: coroutine of session {0} ({1}) failed: {2}", ptr->m_sessionId,
+                          ptr->m_remoteEndpoint, e.what());
+        }
+
+        ptr->Close();
+    });
 }
 
-void Socket::OnWriteComplete(const boost::system::error_code &ec, size_t length)
+boost::asio::awaitable<bool> Socket::AsyncWaitWritable()
 {
-    if (ec)
+    // Holds the socket until the coroutine is done with it.
+    std::shared_ptr<Socket> ptr = shared<Socket>();
+
+    while (m_writeBackpressured && !IsClosed())
+    {
+        if (!m_writableSignal)
+            m_writableSignal = std::make_unique<boost::asio::steady_timer>(m_socket.get_executor(),
+                                                                           boost::asio::steady_timer::time_point::max());
+
+        boost::system::error_code ec;
+        co_await m_writableSignal->async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    }
+
+    co_return !IsClosed();
+}
+
+boost::asio::awaitable<bool> Socket::AsyncSleep(std::chrono::milliseconds delay)
+{
+    std::shared_ptr<Socket> ptr = shared<Socket>();
+
+    boost::asio::steady_timer timer(m_socket.get_executor(), delay);
+    boost::system::error_code ec;
+    co_await timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+    co_return !IsClosed();
+}
+
+void Socket::ScheduleFlush()
+{
+    if (m_flushScheduled)
         return;
 
-    if (IsClosed())
+    m_flushScheduled = true;
+
+    std::shared_ptr<Socket> ptr = shared<Socket>();
+    const std::chrono::milliseconds maxDelay = SNetworkConfig.GetCorkMaxDelay();
+    if (maxDelay.count() == 0)
+    {
+        // Posted handlers only run after the current one returns, so everything written by it goes out together.
+        boost::asio::post(m_socket.get_executor(), [ptr]() { ptr->Flush(); });
         return;
+    }
+
+    if (!m_corkTimer)
+        m_corkTimer = std::make_unique<boost::asio::steady_timer>(m_socket.get_executor());
 
-    if (length < m_outBuffer->m_writePosition)
+    m_corkTimer->expires_after(maxDelay);
+    m_corkTimer->async_wait([ptr](const boost::system::error_code& ec)
     {
-        memcpy(&(m_outBuffer->m_buffer[0]), &(m_outBuffer->m_buffer[length]),
-               (m_outBuffer->m_writePosition - length) * sizeof(m_outBuffer->m_buffer[0]));
-        m_outBuffer->m_writePosition -= length;
+        // Only cancelled by the teardown, which leaves nothing to flush.
+        if (ec)
+            return;
+
+        ptr->Flush();
+    });
+}
+
+void Socket::Flush()
+{
+    m_flushScheduled = false;
+
+    if (m_isWriting || IsClosed())
+        return;
+
+    if (!m_writeQueue || m_writeQueue->Buffers.empty())
+    {
+        if (GetState() == SocketState::Closing)
+            Close();
+
+        return;
     }
-    else
-        m_outBuffer->m_writePosition = 0;
+
+    NetworkStats::Increment(SNetworkStats.CorkFlushes);
+    StartAsyncWrite();
+}
+
+void Socket::StartAsyncWrite()
+{
+    std::vector<boost::asio::const_buffer>& inFlight = m_writeQueue->InFlight;
+    inFlight.clear();
+    for (auto itr = m_writeQueue->Buffers.begin(); itr != m_writeQueue->Buffers.end() && inFlight.size() < MAX_WRITE_BUFFERS; ++itr)
+        inFlight.emplace_back(itr->data(), itr->size());
+
+    m_writeBufferCount = inFlight.size();
+    m_isWriting = true;
+    NetworkStats::Increment(SNetworkStats.WriteCalls);
 
     std::shared_ptr<Socket> ptr = shared<Socket>();
-    if (m_outBuffer->m_writePosition > 0)
-        m_socket.async_write_some(boost::asio::buffer(m_outBuffer->m_buffer, m_outBuffer->m_writePosition),
-                                  make_custom_alloc_handler(m_allocator, [ptr](const boost::system::error_code& ec, size_t length)
-                                  { ptr->OnWriteComplete(ec, length); }));
+    boost::asio::async_write(m_socket, inFlight,
+                             make_custom_alloc_handler(m_writeAllocator, [ptr](const boost::system::error_code& ec, size_t length)
+                             { ptr->OnWriteComplete(ec, length); }));
+}
+
+void Socket::OnWriteComplete(const boost::system::error_code &ec, size_t length)
+{
+    // async_write only completes successfully once every buffer in the sequence has been sent, so the whole
+    // gathered batch can be released at once without touching the data that is still queued.
+    if (ec || IsClosed())
+    {
+        m_writeQueue->Buffers.clear();
+        m_writeQueueBytes = 0;
+        m_writeBufferCount = 0;
+        m_isWriting = false;
+        m_writeBackpressured = false;
+
+        Close();
+        return;
+    }
+
+    NetworkStats::Increment(SNetworkStats.BytesSent, length);
+    GetContext().AddBytesTransferred(length);
+
+    m_writeQueue->Buffers.erase(m_writeQueue->Buffers.begin(), m_writeQueue->Buffers.begin() + (std::ptrdiff_t) m_writeBufferCount);
+    m_writeQueueBytes -= length;
+    m_writeBufferCount = 0;
+
+    if (m_writeBackpressured && m_writeQueueBytes <= SNetworkConfig.GetSendQueueLowWatermark())
+    {
+        m_writeBackpressured = false;
+        if (m_writableSignal)
+            m_writableSignal->cancel();
+    }
+
+    // Anything queued while the write was in flight has already been held back for at least as long as a corked
+    // flush would, so it goes out right away.
+    if (!m_writeQueue->Buffers.empty())
+    {
+        StartAsyncWrite();
+        return;
+    }
+
+    m_isWriting = false;
+    if (GetState() == SocketState::Closing && !m_flushScheduled)
+        Close();
 }
 
 bool Socket::Read(char *buffer, int length)
@@ -173,7 +708,7 @@ bool Socket::Read(char *buffer, int length)
     if (ReadLengthRemaining() < length)
         return false;
 
-    m_inBuffer->Read(buffer, length);
+    m_inBuffer.Read(buffer, length);
 
     return true;
 }
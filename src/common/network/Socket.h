@@ -16,50 +16,211 @@
 #ifndef GCEMU_SOCKET_H
 #define GCEMU_SOCKET_H
 
-#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
 #include <boost/asio.hpp>
+#include "AdmissionControl.h"
+#include "FrameDecoder.h"
+#include "NetworkContext.h"
 #include "PacketBuffer.h"
 
+// Lifecycle of a connection. Sockets only ever move forward through these states:
+// - Open: reading and writing.
+// - Closing: no longer reading, closes once everything queued has been sent (see CloseWhenFlushed).
+// - Closed: the connection is being, or has been, torn down. Pending handlers see it and stop.
+// - Reclaimed: removed from its NetworkThread. The object goes away, and its memory back to the pools, as soon as the
+//   last pending handler has run.
+enum class SocketState : uint8_t
+{
+    Open,
+    Closing,
+    Closed,
+    Reclaimed
+};
+
+// Everything about a connection (its asio socket, buffers, queues and timers) is only ever touched from the thread
+// of the NetworkThread serving it: that io_context runs on a single thread, so it acts as the socket's strand and no
+// locking is needed. The few calls meant to be made from elsewhere (Close, CloseWhenFlushed, Write) hand the work
+// over to that thread through the inbox of its NetworkContext.
 class Socket : public std::enable_shared_from_this<Socket>
 {
 public:
-    Socket(boost::asio::io_context& ioContext, const std::function<void (Socket*)>& closeHandler);
+    Socket(NetworkContext& context, const std::function<void (Socket*)>& closeHandler);
+    virtual ~Socket();
+
+    // Checks the freshly accepted connection against the per-source limits (see AdmissionControl), closing it if it is
+    // turned away. Must be called before Open().
+    bool Admit();
 
     virtual bool Open();
+
+    // Closes the connection. Can be called any number of times, from any thread: the first call tears the socket down
+    // on its own thread, the others do nothing.
     void Close();
 
+    // Stops taking new data and closes the socket once everything already queued has been sent. Can be called from
+    // any thread.
+    void CloseWhenFlushed();
+
+    // True once the socket is closed (or reclaimed). A closing socket is not closed yet.
     bool IsClosed() const;
+    SocketState GetState() const;
+
+    // Called by the owning NetworkThread once it has let go of the socket.
+    void SetReclaimed();
+
+    // Identifier of this connection, unique across all the network threads. Set once the socket is registered with
+    // its NetworkThread and meant to be used in logs and metrics.
+    uint64_t GetSessionId() const;
+    void SetSessionId(uint64_t sessionId);
 
     boost::asio::ip::tcp::socket& GetAsioSocket();
 
+    // State of the NetworkThread serving this socket, e.g. to arm timers on its timing wheel (from the socket's thread
+    // only) or to hand it work through the inbox (from anywhere).
+    NetworkContext& GetContext();
+
+    // Consumes the next length bytes of received data, copying them into buffer unless it is null.
     bool Read(char* buffer, int length);
-    void Write(const char* buffer, int32_t length);
+
+    // Queues data to be sent. Returns false when the data was not queued: either the socket is closed, or its send
+    // queue is over the high watermark and the data was dropped (non-critical only) or the peer disconnected.
+    // Called from another thread, the data is handed over to the socket's thread and true only means that it was.
+    bool Write(const char* buffer, int32_t length, bool critical = true);
+    bool Write(std::vector<uint8_t>&& buffer, bool critical = true);
+
+    // True while the send queue is above the high watermark and hasn't drained below the low one yet. Handlers can
+    // use it to hold back optional traffic to a slow peer. Safe to call from any thread.
+    bool IsWriteBackpressured() const;
+
+    // Runs a coroutine on the socket's thread. It may use everything that thread can, and awaits slow work (see
+    // Database::AsyncQuery and the calls below) without holding the thread up. The socket doesn't migrate while one
+    // is running, and is closed if one throws. Must be called on the socket's thread.
+    void Spawn(boost::asio::awaitable<void> coroutine);
+
+    // For coroutines running on the socket's thread. AsyncWaitWritable completes once the send queue is no longer
+    // backpressured, right away when it isn't; AsyncSleep after the given delay. Both return false when the socket
+    // was closed by then.
+    boost::asio::awaitable<bool> AsyncWaitWritable();
+    boost::asio::awaitable<bool> AsyncSleep(std::chrono::milliseconds delay);
+
+    // Gives back the buffers of a connection that has had no activity since idleSince.
+    void ReleaseIdleMemory(std::chrono::steady_clock::time_point idleSince);
+
+    // Approximate number of bytes held by this connection.
+    size_t GetMemoryUsage();
+
+    // Bytes waiting in the send queue.
+    size_t GetQueuedBytes() const;
+
+    // Migration to another NetworkThread (see NetworkThread::MigrateSockets). Only an open socket with nothing
+    // received pending and nothing left to send can move, so all that moves is the file descriptor and the timers.
+    // Migrate is called on the socket's thread once it is out of its table: it stops the pending read and then queues
+    // attach on the target's thread. Attach rebinds the socket to the target, returning false when it was closed on
+    // the way, and Resume starts reading again once it is registered there.
+    bool CanMigrate() const;
+    void Migrate(NetworkContext& target, std::function<void()> attach);
+    bool Attach(const std::function<void(Socket*)>& closeHandler);
+    void Resume();
 
     template <typename T>
     std::shared_ptr<T> shared() { return std::static_pointer_cast<T>(shared_from_this()); }
 
 protected:
-    virtual bool ProcessIncomingData() = 0;
+    // Handles one frame taken out of the received data (see FrameDecoder), header included. The data is only valid
+    // for the duration of the call. Returning false closes the connection.
+    virtual bool ProcessFrame(const uint8_t* frame, size_t length) = 0;
+
+    // Called once, on the socket's thread, when the connection is torn down. Meant for releasing whatever the
+    // connection holds outside of the socket (timers, session state).
+    virtual void OnClose() {}
+
+    // Called on the old thread when the socket starts migrating, and on the new one once it is attached there. Meant
+    // for moving whatever else the connection keeps on its thread, such as timers.
+    virtual void OnDetach() {}
+    virtual void OnAttach() {}
+
     size_t ReadLengthRemaining() const;
 
+    // Whether the caller runs on the socket's thread, i.e. may touch the socket's state directly.
+    bool RunsInSocketThread() const;
+
     std::string m_address;
     std::string m_remoteEndpoint;
     boost::asio::ip::address m_remoteAddress;
     uint16_t m_remotePort = 0;
+    uint64_t m_sessionId = 0;
 
 private:
+    void Teardown();
+    void Detach();
+
     void StartAsyncRead();
+    void OnReadable(const boost::system::error_code& ec);
     void OnRead(const boost::system::error_code& ec, size_t length);
+    bool GrowReceiveBuffer();
+    void OnIdleTimeout();
+    void StartAsyncWrite();
+    void ScheduleFlush();
+    void Flush();
     void OnWriteComplete(const boost::system::error_code& ec, size_t length);
 
+    // Maximum number of queued buffers gathered into a single write.
+    static constexpr size_t MAX_WRITE_BUFFERS = 64;
+
+    // Changes when the socket migrates, while other threads may be reading it to hand work over.
+    std::atomic<NetworkContext*> m_context;
     boost::asio::ip::tcp::socket m_socket;
 
-    std::mutex m_closeLock;
+    // Set while migrating, from Migrate until Attach.
+    NetworkContext* m_migrationTarget = nullptr;
+    std::function<void()> m_attach;
+    boost::asio::ip::tcp::socket::native_handle_type m_migratingHandle {};
+    std::chrono::milliseconds m_idleRemaining {0};
+
+    std::atomic<SocketState> m_state {SocketState::Open};
 
     std::function<void(Socket*)> m_closeHandler;
 
-    std::unique_ptr<PacketBuffer> m_inBuffer;
-    std::unique_ptr<PacketBuffer> m_outBuffer;
+    // Admission control entry counting this connection, handed back when it closes.
+    int32_t m_admissionSlot = AdmissionControl::INVALID_SLOT;
+
+    PacketBuffer m_inBuffer;
+    FrameDecoder m_frameDecoder;
+    std::vector<uint8_t> m_readViewScratch;
+
+    // The receive buffer starts small, grows while frames don't fit and is released when the connection goes idle.
+    std::chrono::steady_clock::time_point m_lastActivity;
+
+    // Re-armed on every read; closes connections that went silent without the peer ever closing them.
+    TimingWheel::Timer m_idleTimer;
+
+    // Outgoing data is kept as a queue of owned buffers, which are flushed together with a single gathered write.
+    // Only one write is in flight at a time; InFlight holds the buffer sequence for it, which covers the first
+    // m_writeBufferCount entries of the queue. The queue is only allocated on the first write.
+    struct WriteQueue
+    {
+        std::deque<std::vector<uint8_t>> Buffers;
+        std::vector<boost::asio::const_buffer> InFlight;
+    };
+
+    std::unique_ptr<WriteQueue> m_writeQueue;
+    size_t m_writeBufferCount = 0;
+    size_t m_writeQueueBytes = 0;
+    bool m_isWriting = false;
+    std::atomic<bool> m_writeBackpressured {false};
+
+    // Never expires; cancelled to wake the coroutines in AsyncWaitWritable when the backpressure clears.
+    std::unique_ptr<boost::asio::steady_timer> m_writableSignal;
+
+    // Coroutines started by Spawn that haven't finished yet.
+    size_t m_runningCoroutines = 0;
+
+    // While corked, the first write of a burst only schedules a flush instead of hitting the socket right away.
+    bool m_flushScheduled = false;
+    std::unique_ptr<boost::asio::steady_timer> m_corkTimer;
 
     // custom allocator based on example from http://www.boost.org/doc/libs/1_62_0/doc/html/boost_asio/example/cpp11/allocation/server.cpp
     // Class to manage the memory to be used for handler-based custom allocation.
@@ -141,6 +302,7 @@ private:
     }
 
     handler_allocator m_allocator;
+    handler_allocator m_writeAllocator;
 };
 
 #endif //GCEMU_SOCKET_H
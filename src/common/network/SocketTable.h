@@ -0,0 +1,135 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_SOCKETTABLE_H
+#define GCEMU_SOCKETTABLE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Slab of sockets indexed by generation-tagged handles. Insertion and removal are O(1) and never move the other
+// entries. The table itself is meant to be used from a single thread (the owning NetworkThread); only Size() may be
+// read from other threads.
+//
+// A handle packs, from the most to the least significant bits: the owner index (8 bits), the slot generation (24 bits)
+// and the slot index (32 bits). The generation is bumped every time a slot is freed, so a stale handle never resolves
+// to a socket that later reused the slot, and handles from different owners never collide.
+template <typename SocketType>
+class SocketTable
+{
+public:
+    typedef uint64_t Handle;
+    static constexpr Handle INVALID_HANDLE = 0;
+
+    explicit SocketTable(uint8_t ownerIndex = 0) : m_ownerIndex(ownerIndex)
+    {
+    }
+
+    Handle Insert(std::shared_ptr<SocketType> socket)
+    {
+        uint32_t index;
+        if (!m_freeSlots.empty())
+        {
+            index = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+        else
+        {
+            index = (uint32_t) m_slots.size();
+            m_slots.emplace_back();
+        }
+
+        Slot& slot = m_slots[index];
+        slot.Socket = std::move(socket);
+        m_liveCount.fetch_add(1, std::memory_order_relaxed);
+
+        return MakeHandle(index, slot.Generation);
+    }
+
+    std::shared_ptr<SocketType> Remove(Handle handle)
+    {
+        uint32_t index;
+        if (!FindSlot(handle, index))
+            return nullptr;
+
+        Slot& slot = m_slots[index];
+        std::shared_ptr<SocketType> socket = std::move(slot.Socket);
+        slot.Generation = (slot.Generation + 1) & GENERATION_MASK;
+        if (slot.Generation == 0)
+            slot.Generation = 1;
+
+        m_freeSlots.push_back(index);
+        m_liveCount.fetch_sub(1, std::memory_order_relaxed);
+
+        return socket;
+    }
+
+    std::shared_ptr<SocketType> Get(Handle handle) const
+    {
+        uint32_t index;
+        return FindSlot(handle, index) ? m_slots[index].Socket : nullptr;
+    }
+
+    size_t Size() const
+    {
+        return m_liveCount.load(std::memory_order_relaxed);
+    }
+
+    // The function may close, and so remove, the socket it is given.
+    template <typename Function>
+    void ForEach(Function&& function)
+    {
+        for (size_t i = 0; i < m_slots.size(); i++)
+        {
+            if (std::shared_ptr<SocketType> socket = m_slots[i].Socket)
+                function(socket);
+        }
+    }
+
+private:
+    static constexpr uint64_t INDEX_MASK = 0xFFFFFFFF;
+    static constexpr uint32_t GENERATION_MASK = 0xFFFFFF;
+
+    struct Slot
+    {
+        std::shared_ptr<SocketType> Socket;
+        // Never 0, so no valid handle is ever equal to INVALID_HANDLE.
+        uint32_t Generation = 1;
+    };
+
+    Handle MakeHandle(uint32_t index, uint32_t generation) const
+    {
+        return ((uint64_t) m_ownerIndex << 56) | ((uint64_t) generation << 32) | index;
+    }
+
+    bool FindSlot(Handle handle, uint32_t& index) const
+    {
+        index = (uint32_t) (handle & INDEX_MASK);
+        if ((handle >> 56) != m_ownerIndex || index >= m_slots.size())
+            return false;
+
+        const Slot& slot = m_slots[index];
+        return slot.Socket && slot.Generation == ((handle >> 32) & GENERATION_MASK);
+    }
+
+    uint8_t m_ownerIndex;
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+    std::atomic<size_t> m_liveCount {0};
+};
+
+#endif //GCEMU_SOCKETTABLE_H
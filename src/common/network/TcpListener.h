@@ -16,11 +16,17 @@
 #ifndef GCEMU_TCPLISTENER_H
 #define GCEMU_TCPLISTENER_H
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <thread>
+#include <vector>
 #include <boost/asio.hpp>
+#include "NetworkConfig.h"
+#include "NetworkStats.h"
 #include "NetworkThread.h"
-#include <iostream>
+#include "Packet.h"
+#include <spdlog/spdlog.h>
 
 template <typename SocketType>
 class TcpListener
@@ -29,38 +35,172 @@ public:
     TcpListener(const std::string& address, int32_t port, int32_t workerThreads);
     ~TcpListener();
 
+    // Stops accepting connections and closes the open ones once their pending data is sent, waiting for at most the
+    // drain timeout. Whatever is left after that is closed abruptly when the listener is destroyed.
+    void Shutdown(std::chrono::milliseconds drainTimeout);
+
+    // Live connections over all the workers. Safe to call from any thread.
+    size_t GetConnectionCount() const;
+
+    // Sockets and receive buffers held from the pools of all the workers (see NetworkContext::GetPoolUsage). Once
+    // every connection is gone and the listener stopped accepting, both are back to 0. Safe to call from any thread.
+    void GetPoolUsage(size_t& sockets, size_t& buffers) const;
+
+    // Sends the packet to every connection, or only to the given ones. The packet is serialized once, into a buffer
+    // the recipients share, and each NetworkThread involved gets a single task sealing it for its own recipients,
+    // rather than one task per recipient. Safe to call from any thread.
+    void Broadcast(Packet& packet, bool critical = true);
+    static void Broadcast(Packet& packet, const std::vector<std::shared_ptr<SocketType>>& recipients, bool critical = true);
+
 private:
     void StartAccept();
     void OnAccept(const std::shared_ptr<NetworkThread<SocketType>>& worker, const std::shared_ptr<SocketType>& socket, const boost::system::error_code& ec);
 
+    // New connections go to the least loaded worker (see NetworkContext::GetLoadScore).
     std::shared_ptr<NetworkThread<SocketType>> SelectWorker();
 
-    boost::asio::io_context m_ioContext;
-    boost::asio::ip::tcp::acceptor m_acceptor;
+    // Moves connections from the most to the least loaded worker while their scores are more than the migration
+    // threshold apart.
+    void ScheduleRebalance();
+    void Rebalance();
 
+    void ScheduleStatsLog();
+    void LogStats();
+
+    // Declared first so the workers, and the pools their sockets come from, outlive the socket held by a pending
+    // accept on m_ioContext.
     std::vector<std::shared_ptr<NetworkThread<SocketType>>> m_workerThreads;
 
+    boost::asio::io_context m_ioContext;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::asio::steady_timer m_statsTimer;
+    boost::asio::steady_timer m_rebalanceTimer;
+
     std::thread m_acceptorThread;
 };
 
 template <typename SocketType>
-TcpListener<SocketType>::TcpListener(const std::string &address, int32_t port, int32_t workerThreads) : m_ioContext(boost::asio::io_context()), m_acceptor(m_ioContext)
+TcpListener<SocketType>::TcpListener(const std::string &address, int32_t port, int32_t workerThreads) : m_ioContext(boost::asio::io_context()), m_acceptor(m_ioContext),
+                                                                                                        m_statsTimer(m_ioContext), m_rebalanceTimer(m_ioContext)
 {
-    m_acceptor = boost::asio::ip::tcp::acceptor(m_ioContext, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port));
+    const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
 
     m_workerThreads.reserve(workerThreads);
     for (int32_t i = 0; i < workerThreads; i++)
-        m_workerThreads.push_back(std::make_unique<NetworkThread<SocketType>>());
+        m_workerThreads.push_back(std::make_unique<NetworkThread<SocketType>>((uint8_t) i));
+
+    // With SO_REUSEPORT every worker accepts on its own, so connections are accepted on the thread that serves them
+    // and the acceptor thread is only left with housekeeping.
+    if (SNetworkConfig.IsReusePortEnabled())
+    {
+        for (auto& worker : m_workerThreads)
+            worker->Listen(endpoint);
+    }
+    else
+    {
+        m_acceptor = boost::asio::ip::tcp::acceptor(m_ioContext, endpoint);
+        StartAccept();
+    }
 
-    StartAccept();
-    m_acceptorThread = std::thread([this] () { m_ioContext.run(); });
+    ScheduleStatsLog();
+    ScheduleRebalance();
+    m_acceptorThread = std::thread([this] ()
+    {
+        SThreadAffinity.Apply(ThreadAffinity::ThreadRole::Acceptor, 0);
+        m_ioContext.run();
+    });
 }
 
 template <typename SocketType>
 TcpListener<SocketType>::~TcpListener()
 {
-    m_ioContext.post([this]() { m_acceptor.close(); });
+    m_ioContext.post([this]() { m_acceptor.close(); m_statsTimer.cancel(); m_rebalanceTimer.cancel(); });
     m_acceptorThread.join();
+
+    for (auto& worker : m_workerThreads)
+        worker->StopListening();
+
+    LogStats();
+}
+
+template <typename SocketType>
+void TcpListener<SocketType>::Shutdown(std::chrono::milliseconds drainTimeout)
+{
+    boost::asio::post(m_ioContext, [this]() { m_acceptor.close(); m_rebalanceTimer.cancel(); });
+    for (auto& worker : m_workerThreads)
+    {
+        worker->StopListening();
+        worker->Drain();
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + drainTimeout;
+    while (GetConnectionCount() > 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    if (const size_t remaining = GetConnectionCount())
+        spdlog::warn("TcpListener::Shutdown: {0} connections did not drain in time.", remaining);
+}
+
+template <typename SocketType>
+size_t TcpListener<SocketType>::GetConnectionCount() const
+{
+    size_t count = 0;
+    for (auto& worker : m_workerThreads)
+        count += worker->Size();
+
+    return count;
+}
+
+template <typename SocketType>
+void TcpListener<SocketType>::GetPoolUsage(size_t& sockets, size_t& buffers) const
+{
+    sockets = buffers = 0;
+    for (auto& worker : m_workerThreads)
+    {
+        size_t workerSockets, workerBuffers;
+        worker->GetPoolUsage(workerSockets, workerBuffers);
+        sockets += workerSockets;
+        buffers += workerBuffers;
+    }
+}
+
+template <typename SocketType>
+void TcpListener<SocketType>::Broadcast(Packet& packet, bool critical)
+{
+    const Packet::SharedPlaintext plaintext = std::make_shared<const std::vector<uint8_t>>(packet.Serialize());
+    for (auto& worker : m_workerThreads)
+        worker->Broadcast(plaintext, critical);
+}
+
+template <typename SocketType>
+void TcpListener<SocketType>::Broadcast(Packet& packet, const std::vector<std::shared_ptr<SocketType>>& recipients, bool critical)
+{
+    if (recipients.empty())
+        return;
+
+    const Packet::SharedPlaintext plaintext = std::make_shared<const std::vector<uint8_t>>(packet.Serialize());
+
+    // There are only a handful of threads, so they are simply looked up in a vector.
+    std::vector<std::pair<NetworkContext*, std::vector<std::shared_ptr<SocketType>>>> batches;
+    for (const std::shared_ptr<SocketType>& recipient : recipients)
+    {
+        NetworkContext* context = &recipient->GetContext();
+        auto batch = std::find_if(batches.begin(), batches.end(), [context] (const auto& batch) { return batch.first == context; });
+        if (batch == batches.end())
+            batch = batches.emplace(batches.end(), context, std::vector<std::shared_ptr<SocketType>>());
+
+        batch->second.push_back(recipient);
+    }
+
+    // A recipient that migrated in the meantime forwards its part to its new thread.
+    for (auto& batch : batches)
+    {
+        batch.first->GetInbox().Push([plaintext, critical, sockets = std::move(batch.second)] ()
+        {
+            for (const std::shared_ptr<SocketType>& socket : sockets)
+                socket->SendPlaintext(plaintext, critical);
+        });
+    }
 }
 
 template <typename SocketType>
@@ -80,11 +220,12 @@ void TcpListener<SocketType>::OnAccept(const std::shared_ptr<NetworkThread<Socke
 {
     if (ec)
     {
-        std::cout << ec.message() << std::endl;
-        worker->RemoveSocket(socket.get());
+        // Aborted accepts are expected on shutdown.
+        if (ec != boost::asio::error::operation_aborted)
+            spdlog::error("TcpListener::OnAccept: {0}", ec.message());
     }
     else
-        socket->Open();
+        worker->AddSocket(socket);
 
     if (m_acceptor.is_open())
         StartAccept();
@@ -94,13 +235,16 @@ template <typename SocketType>
 std::shared_ptr<NetworkThread<SocketType>> TcpListener<SocketType>::SelectWorker()
 {
     size_t minIndex = 0;
+    uint64_t minScore = m_workerThreads[minIndex]->GetLoadScore();
     size_t minSize = m_workerThreads[minIndex]->Size();
 
     for (size_t i = 1; i < m_workerThreads.size(); i++)
     {
+        const uint64_t score = m_workerThreads[i]->GetLoadScore();
         const size_t size = m_workerThreads[i]->Size();
-        if (size < minSize)
+        if (score < minScore || (score == minScore && size < minSize))
         {
+            minScore = score;
             minSize = size;
             minIndex = i;
         }
@@ -109,4 +253,77 @@ std::shared_ptr<NetworkThread<SocketType>> TcpListener<SocketType>::SelectWorker
     return m_workerThreads[minIndex];
 }
 
+template <typename SocketType>
+void TcpListener<SocketType>::ScheduleRebalance()
+{
+    if (SNetworkConfig.GetMigrationThreshold() == 0 || m_workerThreads.size() < 2)
+        return;
+
+    // The load scores are only sampled once per sweep.
+    m_rebalanceTimer.expires_after(SNetworkConfig.GetSweepInterval());
+    m_rebalanceTimer.async_wait([this] (const boost::system::error_code& ec)
+    {
+        if (ec)
+            return;
+
+        Rebalance();
+        ScheduleRebalance();
+    });
+}
+
+template <typename SocketType>
+void TcpListener<SocketType>::Rebalance()
+{
+    size_t hottest = 0;
+    size_t coldest = 0;
+    std::vector<uint64_t> scores;
+    for (size_t i = 0; i < m_workerThreads.size(); i++)
+    {
+        scores.push_back(m_workerThreads[i]->GetLoadScore());
+        if (scores[i] > scores[hottest])
+            hottest = i;
+        if (scores[i] < scores[coldest])
+            coldest = i;
+    }
+
+    const uint64_t gap = scores[hottest] - scores[coldest];
+    if (gap <= SNetworkConfig.GetMigrationThreshold())
+        return;
+
+    // Assuming the load is spread evenly over the connections of the hottest worker, moving this many of them brings
+    // both workers to the middle of the gap.
+    const size_t count = std::min(SNetworkConfig.GetMigrationBatch(),
+                                  std::max<size_t>((size_t) (m_workerThreads[hottest]->Size() * (gap / 2) / scores[hottest]), 1));
+
+    spdlog::info("TcpListener::Rebalance: moving up to {0} connections from worker {1} (load {2}) to worker {3} (load {4}).",
+                 count, hottest, scores[hottest], coldest, scores[coldest]);
+    m_workerThreads[hottest]->MigrateSockets(count, m_workerThreads[coldest]);
+}
+
+template <typename SocketType>
+void TcpListener<SocketType>::ScheduleStatsLog()
+{
+    if (SNetworkConfig.GetStatsInterval().count() == 0)
+        return;
+
+    m_statsTimer.expires_after(SNetworkConfig.GetStatsInterval());
+    m_statsTimer.async_wait([this] (const boost::system::error_code& ec)
+    {
+        if (ec)
+            return;
+
+        LogStats();
+        ScheduleStatsLog();
+    });
+}
+
+template <typename SocketType>
+void TcpListener<SocketType>::LogStats()
+{
+    SNetworkStats.Log();
+
+    for (auto& worker : m_workerThreads)
+        worker->LogPoolStats();
+}
+
 #endif //GCEMU_TCPLISTENER_H
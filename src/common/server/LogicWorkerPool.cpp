@@ -0,0 +1,219 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "LogicWorkerPool.h"
+#include "../util/ThreadAffinity.h"
+#include <spdlog/spdlog.h>
+
+namespace
+{
+    // Index of the worker running on this thread, if any.
+    thread_local size_t t_workerIndex = SIZE_MAX;
+}
+
+void LogicStrand::Post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_tasks.push_back(std::move(task));
+        if (m_scheduled)
+            return;
+
+        m_scheduled = true;
+    }
+
+    SLogicWorkerPool.Schedule(shared_from_this());
+}
+
+bool LogicStrand::Run(size_t batchSize)
+{
+    for (size_t i = 0; i < batchSize; i++)
+    {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_tasks.empty())
+            {
+                m_scheduled = false;
+                return false;
+            }
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+
+        task();
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_tasks.empty())
+    {
+        m_scheduled = false;
+        return false;
+    }
+
+    return true;
+}
+
+void LogicWorkerPool::Start(size_t threadCount)
+{
+    if (!threadCount)
+    {
+        spdlog::info("LogicWorkerPool::Start: no logic workers, packet handlers run on the network threads.");
+        return;
+    }
+
+    m_stopping = false;
+    for (size_t i = 0; i < threadCount; i++)
+        m_workers.push_back(std::make_unique<Worker>());
+
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        m_workers[i]->Thread = std::thread([this, i] ()
+        {
+            SThreadAffinity.Apply(ThreadAffinity::ThreadRole::Logic, i);
+            WorkerLoop(i);
+        });
+    }
+
+    m_enabled.store(true, std::memory_order_release);
+    spdlog::info("LogicWorkerPool::Start: {0} logic workers started.", threadCount);
+}
+
+void LogicWorkerPool::Stop()
+{
+    if (m_workers.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_idleLock);
+        m_stopping = true;
+    }
+
+    m_idleCondition.notify_all();
+    for (const std::unique_ptr<Worker>& worker : m_workers)
+    {
+        if (worker->Thread.joinable())
+            worker->Thread.join();
+    }
+
+    m_enabled.store(false, std::memory_order_release);
+
+    // Strands scheduled between the last worker leaving and the pool being disabled. Schedule() checks m_enabled under
+    // the queue lock, so nothing can be added to a queue once it has been emptied here.
+    for (const std::unique_ptr<Worker>& worker : m_workers)
+    {
+        std::deque<std::shared_ptr<LogicStrand>> queue;
+        {
+            std::lock_guard<std::mutex> lock(worker->Lock);
+            queue.swap(worker->Queue);
+        }
+
+        for (const std::shared_ptr<LogicStrand>& strand : queue)
+        {
+            while (strand->Run(STRAND_BATCH_SIZE));
+        }
+    }
+}
+
+bool LogicWorkerPool::IsEnabled() const
+{
+    return m_enabled.load(std::memory_order_acquire);
+}
+
+void LogicWorkerPool::Schedule(std::shared_ptr<LogicStrand> strand)
+{
+    const size_t index = t_workerIndex != SIZE_MAX ? t_workerIndex :
+                         m_nextWorker.fetch_add(1, std::memory_order_relaxed) % std::max<size_t>(m_workers.size(), 1);
+    {
+        std::unique_lock<std::mutex> lock;
+        if (!m_workers.empty())
+            lock = std::unique_lock<std::mutex>(m_workers[index]->Lock);
+
+        if (IsEnabled())
+        {
+            m_workers[index]->Queue.push_back(std::move(strand));
+            m_pending.fetch_add(1);
+        }
+    }
+
+    // The pool is stopped (or was never started), the caller runs the strand itself.
+    if (strand)
+    {
+        while (strand->Run(STRAND_BATCH_SIZE));
+        return;
+    }
+
+    // Pairs with the sleeping worker re-checking m_pending after registering itself, so a wakeup is never lost.
+    if (m_sleepingWorkers.load())
+    {
+        std::lock_guard<std::mutex> lock(m_idleLock);
+        m_idleCondition.notify_one();
+    }
+}
+
+std::shared_ptr<LogicStrand> LogicWorkerPool::TakeWork(size_t index)
+{
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        Worker& worker = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(worker.Lock);
+        if (worker.Queue.empty())
+            continue;
+
+        // The own queue is worked from the front, in order. Thieves take from the back, the work its owner would get
+        // to last.
+        std::shared_ptr<LogicStrand> strand;
+        if (i == 0)
+        {
+            strand = std::move(worker.Queue.front());
+            worker.Queue.pop_front();
+        }
+        else
+        {
+            strand = std::move(worker.Queue.back());
+            worker.Queue.pop_back();
+        }
+
+        m_pending.fetch_sub(1);
+        return strand;
+    }
+
+    return nullptr;
+}
+
+void LogicWorkerPool::WorkerLoop(size_t index)
+{
+    t_workerIndex = index;
+
+    for (;;)
+    {
+        if (std::shared_ptr<LogicStrand> strand = TakeWork(index))
+        {
+            if (strand->Run(STRAND_BATCH_SIZE))
+                Schedule(std::move(strand));
+
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_idleLock);
+        m_sleepingWorkers.fetch_add(1);
+        m_idleCondition.wait(lock, [this] () { return m_pending.load() || m_stopping; });
+        m_sleepingWorkers.fetch_sub(1);
+
+        if (m_stopping && !m_pending.load())
+            return;
+    }
+}
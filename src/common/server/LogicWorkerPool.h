@@ -0,0 +1,173 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_LOGICWORKERPOOL_H
+#define GCEMU_LOGICWORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#define SLogicWorkerPool LogicWorkerPool::GetInstance()
+
+class LogicWorkerPool;
+
+// Serial queue of tasks belonging to one session. Tasks of a strand run one at a time and in the order they were
+// posted, but not always on the same thread: the strand as a whole is what the pool schedules, and what idle workers
+// steal from each other.
+class LogicStrand : public std::enable_shared_from_this<LogicStrand>
+{
+public:
+    // Safe to call from any thread.
+    void Post(std::function<void()> task);
+
+    // Runs the task on the pool while the awaiting coroutine is suspended, and resumes the coroutine on its own
+    // executor with what the task returned, or with the exception it threw. Meant for the CPU-bound parts of packet
+    // handlers, so they don't hold up the network thread. With the pool disabled, the task runs right away instead.
+    template <typename Task>
+    boost::asio::awaitable<std::invoke_result_t<Task&>> AsyncRun(Task task);
+
+private:
+    friend class LogicWorkerPool;
+
+    // Runs up to batchSize tasks. Returns whether the strand still has tasks and must be scheduled again.
+    bool Run(size_t batchSize);
+
+    std::mutex m_lock;
+    std::deque<std::function<void()>> m_tasks;
+
+    // Set while the strand sits in a worker queue or is being run, so only one worker ever has it.
+    bool m_scheduled = false;
+};
+
+// Threads running session logic (the CPU-bound work of packet handlers, see LogicStrand::AsyncRun) away from the
+// network threads, so a slow handler only delays its own session. Each worker has its own queue of strands; it takes work from the front of its
+// queue and, once that is empty, steals from the back of the others'. Work scheduled from a worker goes to its own
+// queue, work from anywhere else is spread round robin.
+//
+// Handlers running here must not touch the state of their socket directly, only through the calls that are safe from
+// any thread (SendPacket, Close...), which hand the work back to the network thread.
+class LogicWorkerPool
+{
+public:
+    static LogicWorkerPool& GetInstance()
+    {
+        static LogicWorkerPool instance;
+        return instance;
+    }
+
+    LogicWorkerPool(LogicWorkerPool const&) = delete;
+    void operator=(LogicWorkerPool const&) = delete;
+
+    // Starts the given number of workers. With none, the pool stays disabled and handlers run on the network threads.
+    void Start(size_t threadCount);
+
+    // Runs everything already queued and joins the workers. Tasks posted afterwards run on the posting thread. The pool
+    // can't be started again.
+    void Stop();
+
+    bool IsEnabled() const;
+
+private:
+    friend class LogicStrand;
+
+    LogicWorkerPool() {}
+
+    struct Worker
+    {
+        std::mutex Lock;
+        std::deque<std::shared_ptr<LogicStrand>> Queue;
+        std::thread Thread;
+    };
+
+    void Schedule(std::shared_ptr<LogicStrand> strand);
+    std::shared_ptr<LogicStrand> TakeWork(size_t index);
+    void WorkerLoop(size_t index);
+
+    // Tasks a strand runs before going back to the end of a queue, so a busy session can't hold a worker forever.
+    static constexpr size_t STRAND_BATCH_SIZE = 16;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<bool> m_enabled {false};
+    std::atomic<size_t> m_nextWorker {0};
+
+    // Strands sitting in the worker queues.
+    std::atomic<size_t> m_pending {0};
+
+    // Idle workers sleep here until there is work to take.
+    std::mutex m_idleLock;
+    std::condition_variable m_idleCondition;
+    std::atomic<size_t> m_sleepingWorkers {0};
+    bool m_stopping = false;
+};
+
+template <typename Task>
+boost::asio::awaitable<std::invoke_result_t<Task&>> LogicStrand::AsyncRun(Task task)
+{
+    typedef std::invoke_result_t<Task&> Result;
+
+    if (!SLogicWorkerPool.IsEnabled())
+        co_return task();
+
+    auto initiation = [this] (auto handler, Task task)
+    {
+        // The handler can only be moved, while std::function has to be able to copy the task holding it.
+        struct State
+        {
+            decltype(handler) Handler;
+            Task Work;
+        };
+
+        auto state = std::make_shared<State>(State { std::move(handler), std::move(task) });
+        Post([state] ()
+        {
+            std::exception_ptr exception;
+            std::optional<Result> result;
+            try
+            {
+                result.emplace(state->Work());
+            }
+            catch (...)
+            {
+                exception = std::current_exception();
+            }
+
+            auto handler = std::move(state->Handler);
+            const auto executor = boost::asio::get_associated_executor(handler);
+            boost::asio::post(executor, [handler = std::move(handler), exception, result = std::move(result)] () mutable
+            {
+                handler(exception, std::move(result));
+            });
+        });
+    };
+
+    std::optional<Result> result = co_await boost::asio::async_initiate<const boost::asio::use_awaitable_t<>,
+        void(std::exception_ptr, std::optional<Result>)>(std::move(initiation), boost::asio::use_awaitable, std::move(task));
+    co_return std::move(*result);
+}
+
+#endif //GCEMU_LOGICWORKERPOOL_H
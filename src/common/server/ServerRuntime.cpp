@@ -0,0 +1,79 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "ServerRuntime.h"
+#include <csignal>
+#include <spdlog/spdlog.h>
+
+ServerRuntime::ServerRuntime() : m_signals(m_ioContext, SIGINT, SIGTERM)
+{
+}
+
+void ServerRuntime::AddStage(const std::string& name, const std::function<bool()>& start, const std::function<void()>& stop)
+{
+    m_stages.push_back({ name, start, stop });
+}
+
+int ServerRuntime::Run()
+{
+    for (size_t i = 0; i < m_stages.size(); i++)
+    {
+        spdlog::info("Starting {0}...", m_stages[i].Name);
+        if (!m_stages[i].Start())
+        {
+            spdlog::error("Failed to start {0}.", m_stages[i].Name);
+            StopStages(i);
+            spdlog::default_logger()->flush();
+            return -1;
+        }
+
+        spdlog::info("{0} started.", m_stages[i].Name);
+    }
+
+    m_signals.async_wait([this] (const boost::system::error_code& ec, int signal)
+    {
+        if (ec)
+            return;
+
+        spdlog::warn("ServerRuntime: received signal {0}, shutting down.", signal);
+        m_ioContext.stop();
+    });
+
+    spdlog::info("Server started - <Ctrl-C> to stop");
+    m_ioContext.run();
+
+    StopStages(m_stages.size());
+    spdlog::info("Server stopped.");
+    spdlog::default_logger()->flush();
+
+    return 0;
+}
+
+void ServerRuntime::Stop()
+{
+    boost::asio::post(m_ioContext, [this] () { m_ioContext.stop(); });
+}
+
+void ServerRuntime::StopStages(size_t startedCount)
+{
+    for (size_t i = startedCount; i-- > 0;)
+    {
+        if (!m_stages[i].Stop)
+            continue;
+
+        spdlog::info("Stopping {0}...", m_stages[i].Name);
+        m_stages[i].Stop();
+    }
+}
@@ -0,0 +1,60 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_SERVERRUNTIME_H
+#define GCEMU_SERVERRUNTIME_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+// Runs the server process: starts its subsystems in order, sleeps until SIGINT or SIGTERM (or Stop()) and then stops
+// them in the reverse order. The main thread spends its whole life blocked in the io_context, so it costs no CPU.
+class ServerRuntime
+{
+public:
+    ServerRuntime();
+
+    ServerRuntime(const ServerRuntime&) = delete;
+    ServerRuntime& operator=(const ServerRuntime&) = delete;
+
+    // Adds a stage to the startup sequence. A stage that fails to start aborts the startup, and only the stages that
+    // did start are stopped.
+    void AddStage(const std::string& name, const std::function<bool()>& start, const std::function<void()>& stop = nullptr);
+
+    // Returns the process exit code.
+    int Run();
+
+    // Requests a shutdown. Safe to call from any thread.
+    void Stop();
+
+private:
+    struct Stage
+    {
+        std::string Name;
+        std::function<bool()> Start;
+        std::function<void()> Stop;
+    };
+
+    void StopStages(size_t startedCount);
+
+    boost::asio::io_context m_ioContext;
+    boost::asio::signal_set m_signals;
+
+    std::vector<Stage> m_stages;
+};
+
+#endif //GCEMU_SERVERRUNTIME_H
@@ -17,6 +17,7 @@
 #define GCEMU_BYTEBUFFER_H
 
 #include "ByteConverter.h"
+#include "ByteReader.h"
 #include "StringUtil.h"
 #include <cassert>
 #include <cmath>
@@ -24,7 +25,7 @@
 #include <cstdint>
 #include <vector>
 
-class ByteBuffer
+class ByteBuffer : public ByteReader<ByteBuffer>
 {
 public:
     explicit ByteBuffer(size_t reservedSize = DEFAULT_SIZE)
@@ -98,39 +99,6 @@ public:
         return *this;
     }
 
-    ByteBuffer& operator >>(int32_t& value)
-    {
-        value = Read<int32_t>();
-        return *this;
-    }
-
-    ByteBuffer& operator >>(uint32_t& value)
-    {
-        value = Read<uint32_t>();
-        return *this;
-    }
-
-    std::string ReadString(uint32_t length)
-    {
-        std::string value;
-        for (int i = 0; i < length; i++)
-        {
-            char c = Read<char>();
-            value += c;
-        }
-
-        return value;
-    }
-
-    std::vector<uint8_t> ReadVector(uint32_t length)
-    {
-        std::vector<uint8_t> value(length);
-        for (int i = 0; i < length; i++)
-            value[i] = Read<uint8_t>();
-
-        return value;
-    }
-
     void WriteString(const std::string& str)
     {
         // Write the length of the string first.
@@ -154,9 +122,9 @@ public:
     }
 
 protected:
-    const uint8_t* Data()
+    const uint8_t* Data() const
     {
-        return &m_storage[0];
+        return m_storage.data();
     }
 
     void Resize(size_t newSize)
@@ -181,7 +149,7 @@ protected:
         return m_writePosition;
     }
 
-    size_t Size()
+    size_t Size() const
     {
         return m_storage.size();
     }
@@ -218,6 +186,8 @@ protected:
     std::vector<uint8_t> m_storage;
 
 private:
+    friend class ByteReader<ByteBuffer>;
+
     template <typename T>
     void Append(T value)
     {
@@ -225,24 +195,16 @@ private:
         Append((uint8_t*) &value, sizeof(value));
     }
 
-    template <typename T>
-    T Read()
+    const uint8_t* GetReadData() const
     {
-        T val = Read<T>(m_readPosition);
-        m_readPosition += sizeof(T);
-        return val;
+        return m_storage.data();
     }
 
-    template <typename T>
-    T Read(size_t pos)
+    size_t GetReadSize() const
     {
-        assert(pos + sizeof(T) <= Size());
-        T val = *((T const*)&m_storage[pos]);
-        EndianConvertReverse(val);
-        return val;
+        return m_storage.size();
     }
 
-    size_t m_readPosition = 0;
     size_t m_writePosition = 0;
 };
 
@@ -0,0 +1,153 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_BYTEREADER_H
+#define GCEMU_BYTEREADER_H
+
+#include "ByteConverter.h"
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+
+// Reading side of ByteBuffer and PacketReader, which provide the bytes through GetReadData and GetReadSize.
+//
+// Reads are bounds-checked: one that would go past the end reads nothing, yields zero (or an empty string, vector or
+// span) and sets the underflow flag, which stays set. Every read after it fails the same way, so a handler can read a
+// whole packet and check HasUnderflow once at the end, before using any of it. When the caller has already checked
+// that GetReadLengthRemaining covers what it is about to read, the unchecked reads skip the checks.
+template <typename Derived>
+class ByteReader
+{
+public:
+    Derived& operator >>(uint8_t& value) { value = Read<uint8_t>(); return Self(); }
+    Derived& operator >>(uint16_t& value) { value = Read<uint16_t>(); return Self(); }
+    Derived& operator >>(uint32_t& value) { value = Read<uint32_t>(); return Self(); }
+    Derived& operator >>(uint64_t& value) { value = Read<uint64_t>(); return Self(); }
+    Derived& operator >>(int8_t& value) { value = Read<int8_t>(); return Self(); }
+    Derived& operator >>(int16_t& value) { value = Read<int16_t>(); return Self(); }
+    Derived& operator >>(int32_t& value) { value = Read<int32_t>(); return Self(); }
+    Derived& operator >>(int64_t& value) { value = Read<int64_t>(); return Self(); }
+    Derived& operator >>(float_t& value) { value = Read<float_t>(); return Self(); }
+    Derived& operator >>(double_t& value) { value = Read<double_t>(); return Self(); }
+
+    template <typename T>
+    T Read()
+    {
+        if (!CanRead(sizeof(T)))
+            return T();
+
+        return ReadUnchecked<T>();
+    }
+
+    std::string ReadString(uint32_t length)
+    {
+        const std::span<const uint8_t> data = ReadSpan(length);
+        return std::string((const char*) data.data(), data.size());
+    }
+
+    std::vector<uint8_t> ReadVector(uint32_t length)
+    {
+        const std::span<const uint8_t> data = ReadSpan(length);
+        return std::vector<uint8_t>(data.begin(), data.end());
+    }
+
+    // Copies the next length bytes to output. Returns false, leaving output untouched, on underflow.
+    bool ReadBytes(uint8_t* output, size_t length)
+    {
+        if (!CanRead(length))
+            return false;
+
+        memcpy(output, GetData() + m_readPosition, length);
+        m_readPosition += length;
+        return true;
+    }
+
+    // View of the next length bytes, valid for as long as the data being read.
+    std::span<const uint8_t> ReadSpan(size_t length)
+    {
+        if (!CanRead(length))
+            return std::span<const uint8_t>();
+
+        return ReadSpanUnchecked(length);
+    }
+
+    template <typename T>
+    T ReadUnchecked()
+    {
+        assert(m_readPosition + sizeof(T) <= GetSize());
+
+        T value;
+        memcpy(&value, GetData() + m_readPosition, sizeof(T));
+        EndianConvertReverse(value);
+        m_readPosition += sizeof(T);
+        return value;
+    }
+
+    std::span<const uint8_t> ReadSpanUnchecked(size_t length)
+    {
+        assert(m_readPosition + length <= GetSize());
+
+        const std::span<const uint8_t> data(GetData() + m_readPosition, length);
+        m_readPosition += length;
+        return data;
+    }
+
+    size_t GetReadLengthRemaining() const
+    {
+        return GetSize() - m_readPosition;
+    }
+
+    bool HasUnderflow() const
+    {
+        return m_underflow;
+    }
+
+private:
+    bool CanRead(size_t length)
+    {
+        if (length <= GetReadLengthRemaining())
+            return true;
+
+        // Nothing is readable past a failed read, so whatever comes after it fails too.
+        m_readPosition = GetSize();
+        m_underflow = true;
+        return false;
+    }
+
+    Derived& Self()
+    {
+        return static_cast<Derived&>(*this);
+    }
+
+    const uint8_t* GetData() const
+    {
+        return static_cast<const Derived&>(*this).GetReadData();
+    }
+
+    size_t GetSize() const
+    {
+        return static_cast<const Derived&>(*this).GetReadSize();
+    }
+
+    size_t m_readPosition = 0;
+    bool m_underflow = false;
+};
+
+#endif //GCEMU_BYTEREADER_H
@@ -29,11 +29,10 @@ public:
         // According to https://bobobobo.wordpress.com/2008/02/23/how-to-use-zlib/,
         // the array that will hold the compressed data must be AT LEAST 0.1% larger
         // than the original size of the data, plus 12 extra bytes.
-        uint32_t compressedDataSize = (uint32_t) ((uint32_t) data.size() * 1.1) + 12;
+        uLongf compressedDataSize = (uint32_t) ((uint32_t) data.size() * 1.1) + 12;
 
         std::vector<uint8_t> compressedData(compressedDataSize);
-        int32_t result = compress2(&compressedData[0], reinterpret_cast<uLongf *>(&compressedDataSize),
-                                   data.data(), data.size(), Z_NO_COMPRESSION);
+        int32_t result = compress2(compressedData.data(), &compressedDataSize, data.data(), data.size(), Z_NO_COMPRESSION);
 
         switch (result)
         {
@@ -61,10 +60,13 @@ public:
 
     static std::vector<uint8_t> DecompressData(const std::vector<uint8_t>& data, uint32_t decompressedSize)
     {
-        uint32_t decompressedResultingSize;
+        if (decompressedSize == 0)
+            return std::vector<uint8_t> {};
+
+        // zlib takes the size of the output buffer in it, and gives back how much of it was used.
+        uLongf decompressedResultingSize = decompressedSize;
         std::vector<uint8_t> decompressedData(decompressedSize);
-        int32_t result = uncompress(&decompressedData[0], reinterpret_cast<uLongf *>(&decompressedResultingSize),
-                                   data.data(), data.size());
+        int32_t result = uncompress(decompressedData.data(), &decompressedResultingSize, data.data(), data.size());
 
         switch (result)
         {
@@ -78,6 +80,11 @@ public:
                 return std::vector<uint8_t> {};
                 break;
 
+            case Z_DATA_ERROR:
+                spdlog::error("Compressor::DecompressData: corrupted or incomplete data.");
+                return std::vector<uint8_t> {};
+                break;
+
             case Z_OK:
             default:
                 break;
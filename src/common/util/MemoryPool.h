@@ -0,0 +1,183 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_MEMORYPOOL_H
+#define GCEMU_MEMORYPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Free list of fixed-size memory blocks. Blocks are taken from the heap when the list is empty and kept around once
+// released, so steady churn (e.g. connections coming and going) stops hitting the allocator. Blocks may be released
+// from any thread.
+class MemoryPool
+{
+public:
+    explicit MemoryPool(size_t blockSize) : m_blockSize(blockSize)
+    {
+    }
+
+    ~MemoryPool()
+    {
+        for (void* block : m_freeBlocks)
+            ::operator delete(block);
+    }
+
+    MemoryPool(const MemoryPool&) = delete;
+    MemoryPool& operator=(const MemoryPool&) = delete;
+
+    void* Allocate()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_freeBlocks.empty())
+            {
+                void* block = m_freeBlocks.back();
+                m_freeBlocks.pop_back();
+                m_hits++;
+                m_usedBlocks++;
+                return block;
+            }
+
+            m_misses++;
+            m_usedBlocks++;
+        }
+
+        return ::operator new(m_blockSize);
+    }
+
+    void Deallocate(void* block)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_freeBlocks.push_back(block);
+        m_usedBlocks--;
+    }
+
+    // Pre-allocates blocks so the first allocations don't have to go to the heap. The blocks are written to, so their
+    // pages are faulted in now, on the NUMA node of the calling thread.
+    void Reserve(size_t count)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_freeBlocks.reserve(m_freeBlocks.size() + count);
+        for (size_t i = 0; i < count; i++)
+        {
+            void* block = ::operator new(m_blockSize);
+            std::memset(block, 0, m_blockSize);
+            m_freeBlocks.push_back(block);
+        }
+    }
+
+    // Gives free blocks back to the heap until at most keepBlocks are left.
+    void Trim(size_t keepBlocks)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        while (m_freeBlocks.size() > keepBlocks)
+        {
+            ::operator delete(m_freeBlocks.back());
+            m_freeBlocks.pop_back();
+        }
+
+        m_freeBlocks.shrink_to_fit();
+    }
+
+    size_t GetBlockSize() const
+    {
+        return m_blockSize;
+    }
+
+    void GetStats(uint64_t& hits, uint64_t& misses, size_t& freeBlocks)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        hits = m_hits;
+        misses = m_misses;
+        freeBlocks = m_freeBlocks.size();
+    }
+
+    // Blocks handed out and not released yet.
+    size_t GetUsedBlocks()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_usedBlocks;
+    }
+
+private:
+    const size_t m_blockSize;
+    std::vector<void*> m_freeBlocks;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    size_t m_usedBlocks = 0;
+
+    std::mutex m_lock;
+};
+
+// Standard allocator backed by a MemoryPool, meant for std::allocate_shared: single objects that fit in a block come
+// from the pool, anything else falls back to the heap. The allocator shares ownership of the pool, so blocks can
+// safely be released after whoever created the pool is gone.
+template <typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit PoolAllocator(std::shared_ptr<MemoryPool> pool) : m_pool(std::move(pool))
+    {
+    }
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : m_pool(other.m_pool)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        if (n * sizeof(T) <= m_pool->GetBlockSize())
+            return static_cast<T*>(m_pool->Allocate());
+
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, size_t n)
+    {
+        if (n * sizeof(T) <= m_pool->GetBlockSize())
+            m_pool->Deallocate(pointer);
+        else
+            ::operator delete(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const
+    {
+        return m_pool == other.m_pool;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const
+    {
+        return m_pool != other.m_pool;
+    }
+
+private:
+    template <typename U>
+    friend class PoolAllocator;
+
+    std::shared_ptr<MemoryPool> m_pool;
+};
+
+#endif //GCEMU_MEMORYPOOL_H
@@ -0,0 +1,221 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "ThreadAffinity.h"
+#include "StringUtil.h"
+#include "../config/ConfigHandler.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <spdlog/spdlog.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool ThreadAffinity::Load()
+{
+    const std::string mode = SConfigHandler.GetString("thread_affinity", "none");
+    if (mode == "none")
+    {
+        m_mode = Mode::None;
+        return true;
+    }
+
+#ifndef __linux__
+    spdlog::error("ThreadAffinity::Load: thread affinity is only supported on Linux.");
+    return false;
+#endif
+
+    if (mode == "manual")
+    {
+        m_mode = Mode::Manual;
+
+        const std::pair<const char*, std::vector<int>*> lists[] = {
+            { "network_thread_cpus", &m_networkCpus },
+            { "acceptor_thread_cpus", &m_acceptorCpus },
+            { "database_thread_cpus", &m_databaseCpus },
+            { "logic_thread_cpus", &m_logicCpus }
+        };
+
+        for (const auto& list : lists)
+        {
+            const std::string value = SConfigHandler.GetString(list.first, "");
+            if (!ParseCpuList(value, *list.second))
+            {
+                spdlog::error("ThreadAffinity::Load: invalid CPU list for {0}: {1}", list.first, value);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    if (mode == "numa")
+    {
+        m_mode = Mode::Numa;
+        m_numaNodes = ReadNumaNodes();
+        if (m_numaNodes.empty())
+        {
+            spdlog::error("ThreadAffinity::Load: could not read the CPU topology.");
+            return false;
+        }
+
+        spdlog::info("ThreadAffinity::Load: spreading threads over {0} NUMA nodes.", m_numaNodes.size());
+        return true;
+    }
+
+    spdlog::error("ThreadAffinity::Load: unknown thread affinity mode {0}, expected none, manual or numa.", mode);
+    return false;
+}
+
+void ThreadAffinity::Apply(ThreadRole role, size_t index)
+{
+    std::vector<int> cpus;
+    if (m_mode == Mode::Manual)
+    {
+        const std::vector<int>& list = role == ThreadRole::Network ? m_networkCpus :
+                                       role == ThreadRole::Acceptor ? m_acceptorCpus :
+                                       role == ThreadRole::Database ? m_databaseCpus : m_logicCpus;
+        if (list.empty())
+            return;
+
+        // The acceptor only does housekeeping, so it may use its whole list. Workers each get a core of their own.
+        if (role == ThreadRole::Acceptor)
+            cpus = list;
+        else
+            cpus.push_back(list[index % list.size()]);
+    }
+    else if (m_mode == Mode::Numa)
+    {
+        // The acceptor hands connections to every node, so it simply stays on the first one.
+        cpus = m_numaNodes[role == ThreadRole::Acceptor ? 0 : index % m_numaNodes.size()];
+    }
+    else
+        return;
+
+    const char* roleName = role == ThreadRole::Network ? "network" : role == ThreadRole::Acceptor ? "acceptor" :
+                           role == ThreadRole::Database ? "database" : "logic";
+    if (!PinCurrentThread(cpus))
+    {
+        spdlog::error("ThreadAffinity::Apply: could not pin {0} thread {1}.", roleName, index);
+        return;
+    }
+
+    std::string cpuList;
+    for (int cpu : cpus)
+        cpuList += (cpuList.empty() ? "" : ",") + std::to_string(cpu);
+
+    spdlog::info("ThreadAffinity::Apply: {0} thread {1} pinned to CPUs {2}.", roleName, index, cpuList);
+}
+
+bool ThreadAffinity::ParseCpuList(const std::string& list, std::vector<int>& cpus)
+{
+    cpus.clear();
+
+    for (std::string range : StringUtil::StringSplit(list, ","))
+    {
+        range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+        if (range.empty())
+            continue;
+
+        try
+        {
+            const size_t dash = range.find('-');
+            const int first = std::stoi(range.substr(0, dash));
+            const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            if (first < 0 || last < first)
+                return false;
+
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::vector<std::vector<int>> ThreadAffinity::ReadNumaNodes()
+{
+    std::vector<std::vector<int>> nodes;
+
+    auto readCpuList = [] (const std::filesystem::path& path, std::vector<int>& cpus)
+    {
+        std::ifstream file(path);
+        std::string list;
+        return std::getline(file, list) && ParseCpuList(list, cpus) && !cpus.empty();
+    };
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+    {
+        const std::string name = entry.path().filename().string();
+        if (name.rfind("node", 0) != 0 || name.size() == 4 || !std::all_of(name.begin() + 4, name.end(), ::isdigit))
+            continue;
+
+        const size_t nodeId = std::stoul(name.substr(4));
+        std::vector<int> cpus;
+        if (!readCpuList(entry.path() / "cpulist", cpus))
+            continue;
+
+        if (nodes.size() <= nodeId)
+            nodes.resize(nodeId + 1);
+
+        nodes[nodeId] = std::move(cpus);
+    }
+
+    // Memory-only nodes have no CPUs to run on.
+    nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [] (const std::vector<int>& cpus) { return cpus.empty(); }),
+                nodes.end());
+
+    if (nodes.empty())
+    {
+        std::vector<int> cpus;
+        if (!readCpuList("/sys/devices/system/cpu/online", cpus))
+        {
+            for (unsigned int cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++)
+                cpus.push_back((int) cpu);
+        }
+
+        if (!cpus.empty())
+            nodes.push_back(std::move(cpus));
+    }
+
+    return nodes;
+}
+
+bool ThreadAffinity::PinCurrentThread(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
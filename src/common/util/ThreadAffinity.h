@@ -0,0 +1,83 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_THREADAFFINITY_H
+#define GCEMU_THREADAFFINITY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#define SThreadAffinity ThreadAffinity::GetInstance()
+
+// Decides which CPUs the long-lived server threads may run on. With the "manual" mode each kind of thread gets its
+// own CPU list from the config (network_thread_cpus, acceptor_thread_cpus, database_thread_cpus, logic_thread_cpus),
+// and the threads of a kind are spread one CPU each over its list. With "numa" the threads are spread over the NUMA
+// nodes instead, each one allowed on every CPU of its node, so the scheduler can still balance them but never moves
+// them to another socket. Memory a pinned thread touches first comes from its own node, which is why the pools are
+// filled from the threads that use them.
+class ThreadAffinity
+{
+public:
+    enum class ThreadRole
+    {
+        Network,
+        Acceptor,
+        Database,
+        Logic
+    };
+
+    static ThreadAffinity& GetInstance()
+    {
+        static ThreadAffinity instance;
+        return instance;
+    }
+
+    ThreadAffinity(ThreadAffinity const&) = delete;
+    void operator=(ThreadAffinity const&) = delete;
+
+    bool Load();
+
+    // Pins the calling thread, the index-th thread of the given role. Does nothing when affinity is disabled.
+    void Apply(ThreadRole role, size_t index);
+
+    // Parses a Linux CPU list, e.g. "0-3,8,10-11".
+    static bool ParseCpuList(const std::string& list, std::vector<int>& cpus);
+
+private:
+    ThreadAffinity() {}
+
+    enum class Mode
+    {
+        None,
+        Manual,
+        Numa
+    };
+
+    // CPUs of each NUMA node, read from sysfs. A machine without NUMA information is reported as a single node.
+    static std::vector<std::vector<int>> ReadNumaNodes();
+    static bool PinCurrentThread(const std::vector<int>& cpus);
+
+    Mode m_mode = Mode::None;
+
+    std::vector<int> m_networkCpus;
+    std::vector<int> m_acceptorCpus;
+    std::vector<int> m_databaseCpus;
+    std::vector<int> m_logicCpus;
+
+    std::vector<std::vector<int>> m_numaNodes;
+};
+
+#endif //GCEMU_THREADAFFINITY_H
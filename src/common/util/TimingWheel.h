@@ -0,0 +1,255 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_TIMINGWHEEL_H
+#define GCEMU_TIMINGWHEEL_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Hierarchical timing wheel: timers are kept in intrusive lists bucketed by expiry tick, so arming, re-arming and
+// cancelling are O(1) no matter how many timers exist. Timers further in the future sit in coarser levels and are
+// moved down as the wheel turns. Nothing here runs on its own: the owner calls Advance() from a single periodic timer,
+// and all the calls must come from the same thread.
+class TimingWheel
+{
+private:
+    struct Link
+    {
+        Link* Prev = nullptr;
+        Link* Next = nullptr;
+
+        bool IsLinked() const
+        {
+            return Next != nullptr;
+        }
+
+        void Unlink()
+        {
+            if (!IsLinked())
+                return;
+
+            Prev->Next = Next;
+            Next->Prev = Prev;
+            Prev = Next = nullptr;
+        }
+    };
+
+    // Empty circular list, used as the head of a slot.
+    struct List : Link
+    {
+        List()
+        {
+            Prev = Next = this;
+        }
+
+        List(const List&) = delete;
+        List& operator=(const List&) = delete;
+
+        bool IsEmpty() const
+        {
+            return Next == this;
+        }
+
+        void PushBack(Link* link)
+        {
+            link->Prev = Prev;
+            link->Next = this;
+            Prev->Next = link;
+            Prev = link;
+        }
+
+        // Moves every entry of this list to the back of other.
+        void SpliceInto(List& other)
+        {
+            if (IsEmpty())
+                return;
+
+            Next->Prev = other.Prev;
+            Prev->Next = &other;
+            other.Prev->Next = Next;
+            other.Prev = Prev;
+            Next = Prev = this;
+        }
+    };
+
+public:
+    // A timer is embedded in whatever it times out (e.g. a socket) and unlinks itself when destroyed.
+    class Timer : private Link
+    {
+        friend class TimingWheel;
+
+    public:
+        Timer() = default;
+        explicit Timer(std::function<void()> callback) : m_callback(std::move(callback))
+        {
+        }
+
+        ~Timer()
+        {
+            Cancel();
+        }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        void SetCallback(std::function<void()> callback)
+        {
+            m_callback = std::move(callback);
+        }
+
+        bool IsArmed() const
+        {
+            return IsLinked();
+        }
+
+        void Cancel()
+        {
+            Unlink();
+        }
+
+    private:
+        uint64_t m_expiry = 0;
+        std::function<void()> m_callback;
+    };
+
+    explicit TimingWheel(std::chrono::milliseconds resolution) : m_resolution(std::max(resolution, std::chrono::milliseconds(1))),
+                                                                 m_start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~TimingWheel()
+    {
+        // Leaves any timer still armed in a valid, disarmed state, so it can be destroyed after the wheel.
+        for (auto& level : m_levels)
+        {
+            for (List& slot : level)
+            {
+                while (!slot.IsEmpty())
+                    slot.Next->Unlink();
+            }
+        }
+    }
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    std::chrono::milliseconds GetResolution() const
+    {
+        return m_resolution;
+    }
+
+    // Point in time at which the next tick is due.
+    std::chrono::steady_clock::time_point GetNextTickTime() const
+    {
+        return m_start + m_resolution * (m_currentTick + 1);
+    }
+
+    // Arms the timer to fire once the delay has passed, rounded up to the wheel resolution. A timer that is already
+    // armed is moved to its new expiry.
+    void Schedule(Timer& timer, std::chrono::milliseconds delay)
+    {
+        const uint64_t ticks = (uint64_t) std::max<int64_t>((delay + m_resolution - std::chrono::milliseconds(1)) / m_resolution, 1);
+
+        timer.Unlink();
+        timer.m_expiry = m_currentTick + ticks;
+        Insert(timer);
+    }
+
+    // Time left before an armed timer fires, as far as the wheel can tell. 0 for a timer that isn't armed.
+    std::chrono::milliseconds GetRemaining(const Timer& timer) const
+    {
+        if (!timer.IsArmed() || timer.m_expiry <= m_currentTick)
+            return std::chrono::milliseconds(0);
+
+        return m_resolution * (int64_t) (timer.m_expiry - m_currentTick);
+    }
+
+    // Runs every tick up to now, firing the timers that expire on the way.
+    void Advance(std::chrono::steady_clock::time_point now)
+    {
+        const uint64_t targetTick = (uint64_t) std::max<int64_t>((now - m_start) / m_resolution, 0);
+        while (m_currentTick < targetTick)
+            Tick();
+    }
+
+private:
+    static constexpr size_t SLOT_BITS = 8;
+    static constexpr size_t SLOT_COUNT = 1 << SLOT_BITS;
+    static constexpr size_t LEVEL_COUNT = 4;
+    static constexpr uint64_t SLOT_MASK = SLOT_COUNT - 1;
+
+    void Insert(Timer& timer)
+    {
+        // A timer goes to the lowest level whose current round still covers its expiry. Anything past the last level
+        // lands in one of its slots anyway, and simply gets placed again whenever that slot comes up.
+        size_t level = 0;
+        while (level < LEVEL_COUNT - 1 &&
+               (timer.m_expiry >> (SLOT_BITS * (level + 1))) != (m_currentTick >> (SLOT_BITS * (level + 1))))
+            level++;
+
+        m_levels[level][(timer.m_expiry >> (SLOT_BITS * level)) & SLOT_MASK].PushBack(&timer);
+    }
+
+    void Tick()
+    {
+        m_currentTick++;
+
+        // Whenever a level wraps around, the next slot of the level above holds the timers for the coming round.
+        for (size_t level = 1; level < LEVEL_COUNT; level++)
+        {
+            if ((m_currentTick & (((uint64_t) 1 << (SLOT_BITS * level)) - 1)) != 0)
+                break;
+
+            Cascade(m_levels[level][(m_currentTick >> (SLOT_BITS * level)) & SLOT_MASK]);
+        }
+
+        // The slot is moved aside first, so the callbacks can freely arm and cancel timers (including this one).
+        List expired;
+        m_levels[0][m_currentTick & SLOT_MASK].SpliceInto(expired);
+        while (!expired.IsEmpty())
+        {
+            Timer* timer = static_cast<Timer*>(expired.Next);
+            timer->Unlink();
+
+            if (timer->m_callback)
+                timer->m_callback();
+        }
+    }
+
+    void Cascade(List& slot)
+    {
+        List pending;
+        slot.SpliceInto(pending);
+        while (!pending.IsEmpty())
+        {
+            Timer* timer = static_cast<Timer*>(pending.Next);
+            timer->Unlink();
+            Insert(*timer);
+        }
+    }
+
+    const std::chrono::milliseconds m_resolution;
+    const std::chrono::steady_clock::time_point m_start;
+    uint64_t m_currentTick = 0;
+
+    std::array<std::array<List, SLOT_COUNT>, LEVEL_COUNT> m_levels;
+};
+
+#endif //GCEMU_TIMINGWHEEL_H
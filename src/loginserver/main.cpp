@@ -17,8 +17,14 @@
 #include "../common/config/ConfigHandler.h"
 #include "../common/database/Database.h"
 #include "../common/crypto/Security.h"
+#include "../common/network/AdmissionControl.h"
+#include "../common/network/NetworkConfig.h"
 #include "../common/network/TcpListener.h"
+#include "../common/server/LogicWorkerPool.h"
+#include "../common/server/ServerRuntime.h"
+#include "../common/util/ThreadAffinity.h"
 #include "server/LoginSocket.h"
+#include <algorithm>
 #include <memory>
 #include <openssl/opensslv.h>
 #include <boost/version.hpp>
@@ -26,7 +32,6 @@
 #include <spdlog/sinks/stdout_sinks.h>
 #include <spdlog/sinks/basic_file_sink.h>
 
-bool IsRunning = false;
 Database database;
 
 bool InitLogger()
@@ -48,22 +53,11 @@ bool InitLogger()
     return true;
 }
 
-void OnKillSignal(int i)
-{
-    spdlog::warn("OnKillSignal: abort requested!");
-    spdlog::default_logger()->flush();
-    IsRunning = false;
-}
-
 int main(int argc, char* argv[])
 {
     if (!InitLogger())
         return -1;
 
-    signal(SIGINT, OnKillSignal);
-    signal(SIGABRT, OnKillSignal);
-    signal(SIGTERM, OnKillSignal);
-
     spdlog::set_pattern("%v");
     spdlog::info(R"(   ______ ______ ______                 )");
     spdlog::info(R"(  / ____// ____// ____/____ ___   __  __)");
@@ -72,7 +66,7 @@ int main(int argc, char* argv[])
     spdlog::info(R"(\____/ \____//_____//_/ /_/ /_/ \____/  )");
     spdlog::info("");
 
-    spdlog::info("GCEmu Login Server - <Ctrl-C> to stop");
+    spdlog::info("GCEmu Login Server");
     spdlog::info("{0}, Boost {1}", OPENSSL_VERSION_TEXT, BOOST_LIB_VERSION);
     spdlog::info("");
 
@@ -80,42 +74,78 @@ int main(int argc, char* argv[])
 
     spdlog::info("Server initializing...");
 
+    ServerRuntime runtime;
+    std::unique_ptr<TcpListener<LoginSocket>> listener;
+
     // Set and parse the configuration file.
-    spdlog::info("Loading config file...");
     const std::string configFilename = "loginserver.conf.json";
-    if (!SConfigHandler.SetConfigFile(configFilename))
+    runtime.AddStage("config", [&configFilename] ()
     {
-        spdlog::error("Could not load the config file ({0}) - check if it is correct.", configFilename);
-        return -1;
-    }
-    spdlog::info("Config file ({0}) loaded.", configFilename);
+        if (!SConfigHandler.SetConfigFile(configFilename))
+        {
+            spdlog::error("Could not load the config file ({0}) - check if it is correct.", configFilename);
+            return false;
+        }
 
-    spdlog::info("Initializing OpenSSL...");
-    if (!Security::InitOpenSSL())
-    {
-        spdlog::error("Failed to initialize OpenSSL.");
-        return -1;
-    }
-    spdlog::info("OpenSSL initialized.");
+        if (!SNetworkConfig.Load())
+        {
+            spdlog::error("Invalid network configuration.");
+            return false;
+        }
 
-    spdlog::info("Initializing the database...");
-    if (!database.Initialize(SConfigHandler.GetString("database_info", "127.0.0.1;3306;gcemu;gcemu;gcemu"),
-                             SConfigHandler.GetInt("database_connections", 1)))
-    {
-        spdlog::error("Failed to initialize the database.");
-        return -1;
-    }
-    spdlog::info("Database initialized.");
+        spdlog::info("Network I/O engine: {0}.", NetworkConfig::GetIoEngine());
+
+        SAdmissionControl.Initialize();
+
+        if (!SThreadAffinity.Load())
+        {
+            spdlog::error("Invalid thread affinity configuration.");
+            return false;
+        }
+
+        return true;
+    });
 
-    spdlog::info("Initializing TcpListener...");
-    TcpListener<LoginSocket> listener("",
-                                      SConfigHandler.GetInt("port", 9501),
-                                      SConfigHandler.GetInt("network_threads", 1));
-    spdlog::info("TcpListener initialized.");
+    runtime.AddStage("OpenSSL", [] () { return Security::InitOpenSSL(); });
 
-    IsRunning = true;
+    runtime.AddStage("database", [] ()
+    {
+        return database.Initialize(SConfigHandler.GetString("database_info", "127.0.0.1;3306;gcemu;gcemu;gcemu"),
+                                   SConfigHandler.GetInt("database_connections", 1));
+    },
+    [] () { database.Shutdown(); });
+
+    // Started before the listener, so they are stopped after it has drained: the queries of the connections still
+    // open then get their results, and none comes in once the threads are gone.
+    runtime.AddStage("database query threads", [] ()
+    {
+        database.StartQueryThreads();
+        return true;
+    },
+    [] () { database.StopQueryThreads(); });
+
+    // Same as the query threads: the handler work still queued when the listener has drained is run, and its results
+    // reach network threads that are still there.
+    runtime.AddStage("logic workers", [] ()
+    {
+        SLogicWorkerPool.Start((size_t) std::max(SConfigHandler.GetInt("logic_worker_threads", 0), 0));
+        return true;
+    },
+    [] () { SLogicWorkerPool.Stop(); });
 
-    while (IsRunning);
+    runtime.AddStage("TcpListener", [&listener] ()
+    {
+        listener = std::make_unique<TcpListener<LoginSocket>>("", SConfigHandler.GetInt("port", 9501),
+                                                              SConfigHandler.GetInt("network_threads", 1));
+        return true;
+    },
+    [&listener] ()
+    {
+        // Connections get a chance to flush what was already sent to them before the database goes away. The listener
+        // itself is only destroyed when main returns: the queries and logic work of the connections that didn't drain
+        // still hand their results to its network threads until the query threads and logic workers are stopped.
+        listener->Shutdown(std::chrono::milliseconds(SConfigHandler.GetInt("shutdown_drain_timeout_ms", 5000)));
+    });
 
-    return 0;
+    return runtime.Run();
 }
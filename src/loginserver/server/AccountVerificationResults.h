@@ -5,7 +5,9 @@
 #ifndef GCEMU_ACCOUNTVERIFICATIONRESULTS_H
 #define GCEMU_ACCOUNTVERIFICATIONRESULTS_H
 
-enum AccountVerificationResults
+#include <cstdint>
+
+enum AccountVerificationResults : int32_t
 {
     ERR_USER_NOT_FOUND  = 0x0B,
 };
@@ -0,0 +1,71 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_LOGINMESSAGES_H
+#define GCEMU_LOGINMESSAGES_H
+
+#include "AccountVerificationResults.h"
+#include "LoginOpcodes.h"
+#include "../../common/crypto/SecurityAssociation.h"
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Layouts of the login server packets (see PacketSchema).
+namespace LoginMessages
+{
+    struct EventAcceptConnectionNot
+    {
+        static constexpr uint16_t OPCODE = EVENT_ACCEPT_CONNECTION_NOT;
+
+        uint16_t Spi = 0;
+        SecurityAssociationData SecurityAssociation;
+
+        static constexpr auto Fields = std::make_tuple(&EventAcceptConnectionNot::Spi,
+                                                       &EventAcceptConnectionNot::SecurityAssociation);
+    };
+
+    // Only the leading fields are read so far, the client sends more after them.
+    struct EnuVerifyAccountReq
+    {
+        static constexpr uint16_t OPCODE = ENU_VERIFY_ACCOUNT_REQ;
+
+        std::string Username;
+        std::vector<uint8_t> PasswordHash;
+
+        static constexpr auto Fields = std::make_tuple(&EnuVerifyAccountReq::Username,
+                                                       &EnuVerifyAccountReq::PasswordHash);
+    };
+
+    struct EnuVerifyAccountAck
+    {
+        static constexpr uint16_t OPCODE = ENU_VERIFY_ACCOUNT_ACK;
+
+        AccountVerificationResults Result {};
+        std::u16string Username;
+        std::string NMPassword;
+        uint8_t IsMale = 0;
+        int32_t Age = 0;
+
+        static constexpr auto Fields = std::make_tuple(&EnuVerifyAccountAck::Result,
+                                                       &EnuVerifyAccountAck::Username,
+                                                       &EnuVerifyAccountAck::NMPassword,
+                                                       &EnuVerifyAccountAck::IsMale,
+                                                       &EnuVerifyAccountAck::Age);
+    };
+}
+
+#endif //GCEMU_LOGINMESSAGES_H
@@ -16,14 +16,19 @@
 #include "LoginSocket.h"
 #include "LoginOpcodes.h"
 #include "AccountVerificationResults.h"
+#include "LoginMessages.h"
 #include "../../common/crypto/Security.h"
 #include "../../common/database/Database.h"
+#include "../../common/network/NetworkConfig.h"
 #include "../../common/util/StringUtil.h"
+#include <algorithm>
 #include <spdlog/spdlog.h>
 
 extern Database database;
 
-LoginSocket::LoginSocket(boost::asio::io_context &ioContext, const std::function<void(Socket *)>& closeHandler) : Socket(ioContext, closeHandler)
+LoginSocket::LoginSocket(NetworkContext& context, const std::function<void(Socket *)>& closeHandler) : Socket(context, closeHandler),
+                                                                                                    m_handshakeTimer([this] () { OnTimeout("handshake"); }),
+                                                                                                    m_heartbeatTimer([this] () { OnTimeout("heartbeat"); })
 {
     m_securityAssociation = Security::GetInstance().GetDefaultSecurityAssociation();
 }
@@ -33,26 +38,21 @@ bool LoginSocket::Open()
     if (!Socket::Open())
         return false;
 
+    if (SNetworkConfig.GetHandshakeTimeout().count())
+        GetContext().GetTimingWheel().Schedule(m_handshakeTimer, SNetworkConfig.GetHandshakeTimeout());
+
+    if (SNetworkConfig.GetHeartbeatTimeout().count())
+        GetContext().GetTimingWheel().Schedule(m_heartbeatTimer, SNetworkConfig.GetHeartbeatTimeout());
+
     EventAcceptConnectionNot();
 
     return true;
 }
 
-bool LoginSocket::ProcessIncomingData()
+bool LoginSocket::ProcessFrame(const uint8_t* frame, size_t length)
 {
-    std::vector<uint8_t> packetData(2);
-    if (!Read((char*) packetData.data(), 2))
-        return false;
-
-    // FIXME: it's probably a bad idea to trust the client always on the packet length
-    uint16_t packetLength = (packetData[1] << 8) | packetData[0];
-    packetData.resize(packetLength);
-
-    if (!Read((char*)packetData.data() + 2, packetLength - 2))
-        return false;
-
-    Packet pkt;
-    if (!pkt.LoadData(packetData, m_securityAssociation))
+    PacketReader pkt;
+    if (!Packet::Decode(frame, length, m_securityAssociation, pkt))
         return false;
 
     switch (pkt.GetOpcode())
@@ -63,7 +63,9 @@ bool LoginSocket::ProcessIncomingData()
         case EVENT_ACCEPT_CONNECTION_NOT:
             break;
         case ENU_VERIFY_ACCOUNT_REQ:
-            HandleEnuVerifyAccountReq(pkt);
+            // The client is past the handshake once it asks to log in.
+            m_handshakeTimer.Cancel();
+            RunHandler(Packet(pkt), &LoginSocket::HandleEnuVerifyAccountReq);
         default:
             return true;
     }
@@ -71,14 +73,69 @@ bool LoginSocket::ProcessIncomingData()
     return true;
 }
 
-void LoginSocket::SendPacket(Packet packet)
+void LoginSocket::SendPacket(const Packet& packet, bool critical)
+{
+    if (IsClosed())
+        return;
+
+    // Only the sealing has to wait for the socket's thread.
+    if (!RunsInSocketThread())
+    {
+        SendPlaintext(std::make_shared<const std::vector<uint8_t>>(packet.Serialize()), critical);
+        return;
+    }
+
+    Write(packet.GetDataToSend(m_securityAssociation), critical);
+}
+
+void LoginSocket::SendPlaintext(const Packet::SharedPlaintext& plaintext, bool critical)
 {
     if (IsClosed())
         return;
 
-    std::lock_guard<std::mutex> lock(m_loginSocketMutex);
-    std::vector<uint8_t> packetData = packet.GetDataToSend(m_securityAssociation);
-    Write(reinterpret_cast<const char*>(packetData.data()), (int32_t) packetData.size());
+    // Packets are sealed in the order they are written, so sealing runs on the socket's thread.
+    if (!RunsInSocketThread())
+    {
+        std::shared_ptr<LoginSocket> ptr = shared<LoginSocket>();
+        GetContext().GetInbox().Push([ptr, plaintext, critical] () { ptr->SendPlaintext(plaintext, critical); });
+        return;
+    }
+
+    Write(Packet::Seal(*plaintext, m_securityAssociation), critical);
+}
+
+boost::asio::awaitable<bool> LoginSocket::AsyncSendPacket(Packet packet)
+{
+    const bool writable = co_await AsyncWaitWritable();
+    if (!writable)
+        co_return false;
+
+    SendPacket(packet);
+    co_return true;
+}
+
+void LoginSocket::RunHandler(Packet packet, PacketHandler handler)
+{
+    m_pendingHandlers.emplace_back(std::move(packet), handler);
+    if (m_runningHandlers)
+        return;
+
+    m_runningHandlers = true;
+    Spawn(RunPendingHandlers());
+}
+
+boost::asio::awaitable<void> LoginSocket::RunPendingHandlers()
+{
+    while (!m_pendingHandlers.empty() && !IsClosed())
+    {
+        std::pair<Packet, PacketHandler> pending = std::move(m_pendingHandlers.front());
+        m_pendingHandlers.pop_front();
+
+        co_await (this->*pending.second)(std::move(pending.first));
+    }
+
+    m_pendingHandlers.clear();
+    m_runningHandlers = false;
 }
 
 void LoginSocket::EventAcceptConnectionNot()
@@ -86,53 +143,126 @@ void LoginSocket::EventAcceptConnectionNot()
     uint16_t newSpi;
     auto newSa = Security::GetInstance().CreateNewSecurityAssociation(newSpi);
     if (!newSa)
+    {
+        // The client can't do anything without the accept packet.
+        Close();
         return;
+    }
 
-    Packet pkt(LoginOpcodes::EVENT_ACCEPT_CONNECTION_NOT, false);
-    pkt << newSpi;
-    pkt << newSa->GetSecurityAssociationData();
+    LoginMessages::EventAcceptConnectionNot message;
+    message.Spi = newSpi;
+    message.SecurityAssociation = newSa->GetSecurityAssociationData();
 
-    SendPacket(pkt);
+    SendPacket(Packet::Create(message));
 
     m_securityAssociation = newSa;
+    m_spi = newSpi;
+}
+
+void LoginSocket::OnClose()
+{
+    m_handshakeTimer.Cancel();
+    m_heartbeatTimer.Cancel();
+
+    // Nothing is going to use this connection's Security Association again, and its SPI can go to a new one.
+    Security::GetInstance().RemoveSecurityAssociation(m_spi);
+}
+
+void LoginSocket::OnDetach()
+{
+    TimingWheel& timingWheel = GetContext().GetTimingWheel();
+    auto remaining = [&timingWheel] (const TimingWheel::Timer& timer)
+    {
+        return timer.IsArmed() ? std::max(timingWheel.GetRemaining(timer), std::chrono::milliseconds(1)) :
+                                 std::chrono::milliseconds(0);
+    };
+
+    m_handshakeRemaining = remaining(m_handshakeTimer);
+    m_heartbeatRemaining = remaining(m_heartbeatTimer);
+    m_handshakeTimer.Cancel();
+    m_heartbeatTimer.Cancel();
+}
+
+void LoginSocket::OnAttach()
+{
+    if (m_handshakeRemaining.count())
+        GetContext().GetTimingWheel().Schedule(m_handshakeTimer, m_handshakeRemaining);
+
+    if (m_heartbeatRemaining.count())
+        GetContext().GetTimingWheel().Schedule(m_heartbeatTimer, m_heartbeatRemaining);
+}
+
+void LoginSocket::OnTimeout(const char* reason)
+{
+    // Closing drops the socket from its table, which may be the last reference to it.
+    std::shared_ptr<LoginSocket> ptr = shared<LoginSocket>();
+
+    if (IsClosed())
+        return;
+
+    spdlog::info("LoginSocket::OnTimeout: {0} timeout for session {1} ({2}), closing it.", reason, m_sessionId,
+                 m_remoteEndpoint);
+    Close();
 }
 
 void LoginSocket::HandleEventHeartBitNot()
 {
     spdlog::info("EVENT_HEART_BIT_NOT");
+
+    if (m_heartbeatTimer.IsArmed())
+        GetContext().GetTimingWheel().Schedule(m_heartbeatTimer, SNetworkConfig.GetHeartbeatTimeout());
 }
 
-void LoginSocket::HandleEnuVerifyAccountReq(Packet &pkt)
+boost::asio::awaitable<void> LoginSocket::HandleEnuVerifyAccountReq(Packet pkt)
 {
     spdlog::info("ENU_VERIFY_ACCOUNT_REQ");
+
     // The minimum packet length for this is 61 bytes
     if (pkt.GetPayloadLength() < 61)
     {
         spdlog::error("LoginSocket::HandleEnuVerifyAccountReq invalid size.");
-        return;
+        co_return;
     }
 
-    uint32_t usernameLength;
-    pkt >> usernameLength;
-    std::string username = pkt.ReadString(usernameLength);
+    LoginMessages::EnuVerifyAccountReq request;
+    const bool decoded = co_await RunLogic([&pkt, &request] () { return PacketSchema::Decode(pkt, request); });
+    if (!decoded)
+    {
+        spdlog::error("LoginSocket::HandleEnuVerifyAccountReq: field lengths go past the end of the packet.");
+        co_return;
+    }
+
+    const std::string& username = request.Username;
+    QueryOutcome outcome = co_await database.AsyncPreparedQuery("SELECT * FROM account WHERE username = '%s'", username.c_str());
+    if (IsClosed())
+        co_return;
 
-    uint32_t passwordHashLength;
-    pkt >> passwordHashLength;
-    std::vector<uint8_t> passwordHash = pkt.ReadVector(passwordHashLength);
+    if (!outcome.Succeeded)
+    {
+        // Whether the account exists is unknown, so the client isn't told it doesn't. It can retry once the database
+        // is back.
+        spdlog::error("LoginSocket::HandleEnuVerifyAccountReq: the account lookup failed, closing session {0} ({1}).",
+                      m_sessionId, m_remoteEndpoint);
+        Close();
+        co_return;
+    }
 
-    Packet outPacket((uint16_t) ENU_VERIFY_ACCOUNT_ACK, false);
-    auto queryResult = database.PreparedQuery("SELECT * FROM account WHERE username = '%s'", username.c_str());
-    if (!queryResult)
+    if (!outcome.Result)
     {
         // No account found on the database with the provided data.
         spdlog::info("LoginSocket::HandleEnuVerifyAccountReq: username not found.");
-        outPacket << AccountVerificationResults::ERR_USER_NOT_FOUND;
-        outPacket.WriteU16String(StringUtil::Utf8To16(username));
-        outPacket << (uint32_t) 0x00; // NMPasswd String Length - unused here
-        outPacket << (uint8_t) false; // IsMale - the client sends this as the default value
-        outPacket << 0x14; // Age - the client sends this as the default value
-        SendPacket(outPacket);
-        return;
+        Packet reply = co_await RunLogic([&username] ()
+        {
+            LoginMessages::EnuVerifyAccountAck ack;
+            ack.Result = AccountVerificationResults::ERR_USER_NOT_FOUND;
+            ack.Username = StringUtil::Utf8To16(username); // NMPassword is unused here and stays empty
+            ack.IsMale = false; // The client sends this as the default value
+            ack.Age = 0x14; // The client sends this as the default value
+            return Packet::Create(ack);
+        });
+
+        co_await AsyncSendPacket(std::move(reply));
+        co_return;
     }
 
     spdlog::info("LoginSocket::HandleEnuVerifyAccountReq: username found.");
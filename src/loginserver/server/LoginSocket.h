@@ -19,29 +19,92 @@
 #include "../../common/network/Socket.h"
 #include "../../common/network/Packet.h"
 #include "../../common/crypto/SecurityAssociation.h"
-#include <mutex>
+#include "../../common/server/LogicWorkerPool.h"
+#include <deque>
+#include <utility>
 #include <boost/asio.hpp>
 
 class LoginSocket : public Socket
 {
 public:
-    LoginSocket(boost::asio::io_context& ioContext, const std::function<void(Socket*)>& closeHandler);
+    LoginSocket(NetworkContext& context, const std::function<void(Socket*)>& closeHandler);
 
     bool Open() override;
 
-    void SendPacket(Packet packet);
+    // Non-critical packets are the first to go when the client stops reading (see network_send_queue_overflow).
+    // Can be called from any thread; the packet is then sealed and queued on the socket's thread.
+    void SendPacket(const Packet& packet, bool critical = true);
+
+    // Sends a packet serialized beforehand, e.g. once for all the recipients of a broadcast (see
+    // TcpListener::Broadcast). Can be called from any thread, like SendPacket.
+    void SendPlaintext(const Packet::SharedPlaintext& plaintext, bool critical = true);
+
+    // Sends the packet once the send queue has room for it (see Socket::AsyncWaitWritable). Returns false when the
+    // connection closed first. For the packet handlers.
+    boost::asio::awaitable<bool> AsyncSendPacket(Packet packet);
+
+protected:
+    bool ProcessFrame(const uint8_t* frame, size_t length) override;
 
 private:
-    bool ProcessIncomingData() override;
+    void OnClose() override;
+    void OnDetach() override;
+    void OnAttach() override;
 
     void EventAcceptConnectionNot();
 
+    // Packet handlers are coroutines running on this thread, which await the database and other slow work rather than
+    // block on it (see Socket::Spawn). The packet is handed over by value, as the handler outlives the call that
+    // started it.
+    typedef boost::asio::awaitable<void> (LoginSocket::*PacketHandler)(Packet packet);
+
+    // Queues a packet handler. Handlers of a connection always run one at a time and in the order the packets came
+    // in, even when one is suspended.
+    void RunHandler(Packet packet, PacketHandler handler);
+    boost::asio::awaitable<void> RunPendingHandlers();
+
+    // Hands the CPU-bound part of a handler to the logic workers (see LogicStrand::AsyncRun), on a strand of its own
+    // so the work of a connection still runs in order. The coroutine carries on on this thread with the result.
+    template <typename Task>
+    boost::asio::awaitable<std::invoke_result_t<Task&>> RunLogic(Task task);
+
+    // Closes the connection on behalf of one of the timers below, naming the timeout in the log.
+    void OnTimeout(const char* reason);
+
     void HandleEventHeartBitNot();
-    void HandleEnuVerifyAccountReq(Packet& pkt);
+    boost::asio::awaitable<void> HandleEnuVerifyAccountReq(Packet pkt);
 
     std::shared_ptr<SecurityAssociation> m_securityAssociation = nullptr;
+    uint16_t m_spi = 0;
 
-    std::mutex m_loginSocketMutex;
+    // Armed when the connection opens. The handshake timer is cancelled once the client sends its login request,
+    // the heartbeat one is pushed back by every heartbeat.
+    TimingWheel::Timer m_handshakeTimer;
+    TimingWheel::Timer m_heartbeatTimer;
+
+    // Time the timers above had left when the socket started migrating, 0 for those that weren't armed.
+    std::chrono::milliseconds m_handshakeRemaining {0};
+    std::chrono::milliseconds m_heartbeatRemaining {0};
+
+    // Handlers waiting for the running one, which RunPendingHandlers works through.
+    std::deque<std::pair<Packet, PacketHandler>> m_pendingHandlers;
+    bool m_runningHandlers = false;
+
+    // Only created once the connection has work for the logic workers.
+    std::shared_ptr<LogicStrand> m_logicStrand;
 };
 
+template <typename Task>
+boost::asio::awaitable<std::invoke_result_t<Task&>> LoginSocket::RunLogic(Task task)
+{
+    if (!m_logicStrand && SLogicWorkerPool.IsEnabled())
+        m_logicStrand = std::make_shared<LogicStrand>();
+
+    if (!m_logicStrand)
+        co_return task();
+
+    std::invoke_result_t<Task&> result = co_await m_logicStrand->AsyncRun(std::move(task));
+    co_return result;
+}
+
 #endif //GCEMU_LOGINSOCKET_H
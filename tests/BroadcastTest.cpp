@@ -0,0 +1,233 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// TcpListener::Broadcast, checked from the clients' side: every client opens what it receives with its own Security
+// Association, so a packet sealed with the wrong keys, or serialized wrong, fails the test. Covers broadcasting to
+// every connection, to a subset (whose other members must get nothing), and from several threads at once, where the
+// packets of each sender must still arrive in the order they were sent.
+//
+// Usage: BroadcastTest [connections] [port]
+
+#include "TestClient.h"
+#include "TestUtil.h"
+#include "../src/common/crypto/Security.h"
+#include "../src/common/database/Database.h"
+#include "../src/common/network/TcpListener.h"
+#include "../src/loginserver/server/LoginOpcodes.h"
+#include "../src/loginserver/server/LoginSocket.h"
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <spdlog/spdlog.h>
+
+// The login handlers query it; the test never gets that far.
+Database database;
+
+namespace
+{
+    constexpr int32_t NETWORK_THREADS = 4;
+    constexpr uint32_t SENDER_THREADS = 4;
+    constexpr uint32_t PACKETS_PER_SENDER = 20;
+
+    // Opcode of the broadcast packets. The clients never send it back, so any opcode will do.
+    constexpr uint16_t BROADCAST_OPCODE = EVENT_HEART_BIT_NOT;
+
+    class BroadcastSocket;
+
+    // The opened connections, by the port of the client they serve, so each client can be told apart.
+    std::mutex registryMutex;
+    std::map<uint16_t, std::weak_ptr<BroadcastSocket>> registry;
+
+    class BroadcastSocket : public LoginSocket
+    {
+    public:
+        using LoginSocket::LoginSocket;
+
+        bool Open() override
+        {
+            boost::system::error_code ec;
+            const boost::asio::ip::tcp::endpoint remote = GetAsioSocket().remote_endpoint(ec);
+            if (ec || !LoginSocket::Open())
+                return false;
+
+            std::lock_guard<std::mutex> lock(registryMutex);
+            registry[remote.port()] = shared<BroadcastSocket>();
+            return true;
+        }
+    };
+
+    Packet MakePacket(uint32_t sender, uint32_t sequence)
+    {
+        Packet packet(BROADCAST_OPCODE, false);
+        packet << sender;
+        packet << sequence;
+        packet.WriteString("notice from the broadcast test");
+        return packet;
+    }
+
+    // Reads the next packet of the client and checks it is one MakePacket built, returning what it was built from.
+    bool ReadBroadcast(TestClient& client, uint32_t& sender, uint32_t& sequence)
+    {
+        uint16_t opcode;
+        std::vector<uint8_t> payload;
+        if (!client.ReadPacket(opcode, payload) || opcode != BROADCAST_OPCODE)
+            return false;
+
+        PacketReader reader(opcode, payload.data(), (uint32_t) payload.size());
+        sender = reader.Read<uint32_t>();
+        sequence = reader.Read<uint32_t>();
+        const std::string notice = reader.ReadString(reader.Read<uint32_t>());
+
+        return !reader.HasUnderflow() && reader.GetReadLengthRemaining() == 0 && notice == "notice from the broadcast test";
+    }
+
+    bool ExpectBroadcast(TestClient& client, uint32_t expectedSender, uint32_t expectedSequence)
+    {
+        uint32_t sender, sequence;
+        return ReadBroadcast(client, sender, sequence) && sender == expectedSender && sequence == expectedSequence;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t connections = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200;
+    const int32_t port = argc > 2 ? (int32_t) std::strtol(argv[2], nullptr, 10) : 19504;
+
+    spdlog::set_level(spdlog::level::warn);
+
+    // Every client comes from the same address and doesn't send anything after connecting.
+    const bool configured = TestUtil::LoadConfig("BroadcastTest.conf.json", R"({
+        "network_max_connections_per_ip": 0,
+        "network_accept_rate_per_ip": 0,
+        "network_handshake_timeout_ms": 0,
+        "network_heartbeat_timeout_ms": 0,
+        "network_idle_timeout_ms": 0,
+        "network_stats_interval": 0
+    })");
+
+    if (!TEST_CHECK(configured) || !TEST_CHECK(Security::InitOpenSSL()))
+        return TestUtil::GetExitCode();
+
+    auto listener = std::make_unique<TcpListener<BroadcastSocket>>("", port, NETWORK_THREADS);
+
+    const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), (uint16_t) port);
+    boost::asio::io_context ioContext;
+    std::vector<std::unique_ptr<TestClient>> clients;
+    for (size_t i = 0; i < connections; i++)
+    {
+        auto client = std::make_unique<TestClient>(ioContext);
+        if (!TEST_CHECK(client->Connect(endpoint)))
+            return TestUtil::GetExitCode();
+
+        clients.push_back(std::move(client));
+    }
+
+    TEST_CHECK(TestUtil::WaitFor([&listener, connections] () { return listener->GetConnectionCount() == connections; },
+                                 std::chrono::seconds(10)));
+
+    // To every connection.
+    {
+        Packet packet = MakePacket(0, 1);
+        listener->Broadcast(packet);
+
+        // Each part stops at the first client missing a packet, rather than waiting out the read timeout of every
+        // client after it.
+        size_t received = 0;
+        while (received < connections && ExpectBroadcast(*clients[received], 0, 1))
+            received++;
+
+        TEST_CHECK(received == connections);
+    }
+
+    // To every other connection. A broadcast to everyone follows, so that what the others receive first shows they
+    // didn't get the first one.
+    {
+        std::vector<std::shared_ptr<BroadcastSocket>> recipients;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            for (size_t i = 0; i < connections; i += 2)
+            {
+                const uint16_t clientPort = clients[i]->GetSocket().local_endpoint().port();
+                if (std::shared_ptr<BroadcastSocket> socket = registry[clientPort].lock())
+                    recipients.push_back(std::move(socket));
+            }
+        }
+
+        TEST_CHECK(recipients.size() == (connections + 1) / 2);
+
+        Packet subset = MakePacket(0, 2);
+        TcpListener<BroadcastSocket>::Broadcast(subset, recipients);
+        Packet everyone = MakePacket(0, 3);
+        listener->Broadcast(everyone);
+
+        size_t received = 0;
+        while (received < connections && (received % 2 || ExpectBroadcast(*clients[received], 0, 2)) &&
+               ExpectBroadcast(*clients[received], 0, 3))
+            received++;
+
+        TEST_CHECK(received == connections);
+    }
+
+    // From several threads at once. Each sender numbers its packets, and every client must see each sender's packets
+    // in order, interleaved with the others' in any way.
+    {
+        std::vector<std::thread> senders;
+        for (uint32_t sender = 1; sender <= SENDER_THREADS; sender++)
+        {
+            senders.emplace_back([&listener, sender] ()
+            {
+                for (uint32_t sequence = 1; sequence <= PACKETS_PER_SENDER; sequence++)
+                {
+                    Packet packet = MakePacket(sender, sequence);
+                    listener->Broadcast(packet);
+                }
+            });
+        }
+
+        for (std::thread& thread : senders)
+            thread.join();
+
+        size_t inOrder = 0;
+        for (bool ordered = true; ordered && inOrder < connections; inOrder += ordered)
+        {
+            std::vector<uint32_t> lastSequence(SENDER_THREADS + 1, 0);
+            for (uint32_t i = 0; i < SENDER_THREADS * PACKETS_PER_SENDER && ordered; i++)
+            {
+                uint32_t sender, sequence;
+                ordered = ReadBroadcast(*clients[inOrder], sender, sequence) && sender >= 1 && sender <= SENDER_THREADS &&
+                          sequence == lastSequence[sender] + 1;
+                if (ordered)
+                    lastSequence[sender] = sequence;
+            }
+        }
+
+        TEST_CHECK(inOrder == connections);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.clear();
+    }
+
+    clients.clear();
+    listener->Shutdown(std::chrono::seconds(1));
+    listener.reset();
+    return TestUtil::GetExitCode();
+}
@@ -0,0 +1,180 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Connect/disconnect soak: clients connect to a real TcpListener<LoginSocket>, wait for the accept packet and hang up,
+// either with a FIN or with a reset, for the given number of cycles (1M by default), while the listener keeps
+// rebalancing its connections between threads. At the end nothing may be left behind: no socket table entry, no
+// socket or receive buffer taken from the pools, and no Security Association but the default one.
+//
+// Usage: ConnectionSoak [cycles] [port]
+
+#include "TestUtil.h"
+#include "../src/common/crypto/Security.h"
+#include "../src/common/database/Database.h"
+#include "../src/common/network/TcpListener.h"
+#include "../src/loginserver/server/LoginSocket.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <spdlog/spdlog.h>
+
+// The login handlers query it; the soak never gets that far.
+Database database;
+
+namespace
+{
+    constexpr int32_t NETWORK_THREADS = 4;
+    constexpr size_t CLIENT_THREADS = 8;
+
+    // Resident set size in KiB, to show the memory use stays flat.
+    size_t GetResidentKiB()
+    {
+        FILE* status = std::fopen("/proc/self/status", "r");
+        if (!status)
+            return 0;
+
+        char line[256];
+        size_t kib = 0;
+        while (std::fgets(line, sizeof(line), status))
+        {
+            if (std::sscanf(line, "VmRSS: %zu kB", &kib) == 1)
+                break;
+        }
+
+        std::fclose(status);
+        return kib;
+    }
+
+    // One cycle: connect, read the first bytes of the accept packet, so the server has opened the socket and given it
+    // a Security Association, and hang up.
+    bool RunCycle(boost::asio::io_context& ioContext, const boost::asio::ip::tcp::endpoint& endpoint, bool reset)
+    {
+        boost::system::error_code ec;
+        boost::asio::ip::tcp::socket socket(ioContext);
+        socket.connect(endpoint, ec);
+        if (ec)
+            return false;
+
+        uint8_t header[2];
+        boost::asio::read(socket, boost::asio::buffer(header), ec);
+        if (ec)
+            return false;
+
+        // A zero linger time makes close() send a reset, which the server sees as an error rather than an EOF.
+        if (reset)
+            socket.set_option(boost::asio::socket_base::linger(true, 0), ec);
+
+        socket.close(ec);
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const uint64_t cycles = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    const int32_t port = argc > 2 ? (int32_t) std::strtol(argv[2], nullptr, 10) : 19501;
+
+    spdlog::set_level(spdlog::level::warn);
+
+    // Every client comes from the same address, so the per-IP limits are off.
+    const bool configured = TestUtil::LoadConfig("ConnectionSoak.conf.json", R"({
+        "network_max_connections_per_ip": 0,
+        "network_accept_rate_per_ip": 0,
+        "network_sweep_interval_ms": 50,
+        "network_migration_threshold": 1,
+        "network_migration_batch": 64,
+        "network_stats_interval": 0
+    })");
+
+    if (!TEST_CHECK(configured) || !TEST_CHECK(Security::InitOpenSSL()))
+        return TestUtil::GetExitCode();
+
+    const size_t baseSecurityAssociations = Security::GetInstance().GetSecurityAssociationCount();
+    auto listener = std::make_unique<TcpListener<LoginSocket>>("", port, NETWORK_THREADS);
+
+    const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), (uint16_t) port);
+    std::atomic<uint64_t> nextCycle {0};
+    std::atomic<uint64_t> completed {0};
+    std::atomic<uint64_t> failed {0};
+    std::atomic<size_t> warmResidentKiB {0};
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < CLIENT_THREADS; i++)
+    {
+        clients.emplace_back([&] ()
+        {
+            boost::asio::io_context ioContext;
+            for (uint64_t cycle = nextCycle++; cycle < cycles; cycle = nextCycle++)
+            {
+                if (!RunCycle(ioContext, endpoint, cycle % 2))
+                    failed++;
+
+                const uint64_t done = ++completed;
+                if (done % 100000 == 0)
+                    std::printf("%llu cycles, %zu KiB resident\n", (unsigned long long) done, GetResidentKiB());
+
+                if (done == cycles / 10)
+                    warmResidentKiB = GetResidentKiB();
+            }
+        });
+    }
+
+    for (std::thread& client : clients)
+        client.join();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%llu cycles in %.1f s (%.0f/s), %llu failed, %zu KiB resident (%zu KiB after 10%%)\n",
+                (unsigned long long) cycles, seconds, cycles / seconds, (unsigned long long) failed.load(), GetResidentKiB(),
+                warmResidentKiB.load());
+
+    TEST_CHECK(failed == 0);
+
+    // The server side of the last connections may still be tearing down.
+    const bool tableEmpty = TestUtil::WaitFor([&listener] () { return listener->GetConnectionCount() == 0; },
+                                              std::chrono::seconds(10));
+    const bool spisReleased = TestUtil::WaitFor([baseSecurityAssociations] ()
+    {
+        return Security::GetInstance().GetSecurityAssociationCount() == baseSecurityAssociations;
+    }, std::chrono::seconds(10));
+
+    std::printf("%zu connections left, %zu Security Associations left besides the default one\n",
+                listener->GetConnectionCount(),
+                Security::GetInstance().GetSecurityAssociationCount() - baseSecurityAssociations);
+    TEST_CHECK(tableEmpty);
+    TEST_CHECK(spisReleased);
+
+    // The pending accept holds a pooled socket until the listener stops accepting.
+    listener->Shutdown(std::chrono::seconds(1));
+
+    size_t sockets = 0;
+    size_t buffers = 0;
+    const bool poolsEmpty = TestUtil::WaitFor([&listener, &sockets, &buffers] ()
+    {
+        listener->GetPoolUsage(sockets, buffers);
+        return sockets == 0 && buffers == 0;
+    }, std::chrono::seconds(10));
+
+    std::printf("%zu pooled sockets and %zu pooled buffers still in use\n", sockets, buffers);
+    TEST_CHECK(poolsEmpty);
+
+    listener.reset();
+    return TestUtil::GetExitCode();
+}
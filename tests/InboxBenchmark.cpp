@@ -0,0 +1,135 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Hands small tasks from 1, 4 and 16 producer threads to a single io_context thread, once through a NetworkInbox and
+// once with a boost::asio::post per task, as the network threads did before the inbox. Prints the throughput of both
+// (best of a few rounds) and how many wakeups the inbox needed. Meant to be run from an optimized build.
+//
+// Usage: InboxBenchmark [tasks per round]
+
+#include "TestUtil.h"
+#include "../src/common/network/NetworkInbox.h"
+#include "../src/common/network/NetworkStats.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace
+{
+    constexpr size_t ROUNDS = 3;
+
+    enum class Mode
+    {
+        Inbox,
+        Post
+    };
+
+    // Runs one round and returns how long it took, from the producers starting until the consumer ran the last task.
+    std::chrono::nanoseconds RunRound(Mode mode, size_t producers, uint64_t tasks, uint64_t& ran)
+    {
+        boost::asio::io_context ioContext;
+        NetworkInbox inbox(ioContext);
+        auto guard = boost::asio::make_work_guard(ioContext);
+        std::thread consumer([&ioContext] () { ioContext.run(); });
+
+        // Only ever touched by the consumer thread, which is what the tasks of a network thread look like.
+        uint64_t counter = 0;
+        std::atomic<bool> done {false};
+        const uint64_t tasksPerProducer = tasks / producers;
+        const uint64_t total = tasksPerProducer * producers;
+        auto task = [&counter, &done, total] ()
+        {
+            if (++counter == total)
+                done.store(true, std::memory_order_release);
+        };
+
+        std::atomic<bool> start {false};
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < producers; i++)
+        {
+            threads.emplace_back([&, mode] ()
+            {
+                while (!start.load(std::memory_order_acquire))
+                    std::this_thread::yield();
+
+                for (uint64_t j = 0; j < tasksPerProducer; j++)
+                {
+                    if (mode == Mode::Inbox)
+                        inbox.Push(task);
+                    else
+                        boost::asio::post(ioContext, task);
+                }
+            });
+        }
+
+        const auto begin = std::chrono::steady_clock::now();
+        start.store(true, std::memory_order_release);
+
+        for (std::thread& thread : threads)
+            thread.join();
+
+        while (!done.load(std::memory_order_acquire))
+            std::this_thread::yield();
+
+        const auto elapsed = std::chrono::steady_clock::now() - begin;
+
+        guard.reset();
+        consumer.join();
+
+        ran = counter;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    }
+
+    double MeasureBest(Mode mode, size_t producers, uint64_t tasks)
+    {
+        double best = 0;
+        for (size_t round = 0; round < ROUNDS; round++)
+        {
+            uint64_t ran = 0;
+            const std::chrono::nanoseconds elapsed = RunRound(mode, producers, tasks, ran);
+            TEST_CHECK(ran == tasks / producers * producers);
+
+            best = std::max(best, (double) ran / std::chrono::duration<double>(elapsed).count());
+        }
+
+        return best;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const uint64_t tasks = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+
+    std::printf("%llu tasks per round, best of %zu rounds\n", (unsigned long long) tasks, ROUNDS);
+    std::printf("%10s %16s %16s %8s %18s\n", "producers", "inbox (Mtask/s)", "post (Mtask/s)", "ratio", "inbox wakeups");
+
+    for (size_t producers : {1, 4, 16})
+    {
+        const uint64_t wakeupsBefore = SNetworkStats.InboxWakeups.load();
+        const double inbox = MeasureBest(Mode::Inbox, producers, tasks);
+        const uint64_t wakeups = (SNetworkStats.InboxWakeups.load() - wakeupsBefore) / ROUNDS;
+        const double post = MeasureBest(Mode::Post, producers, tasks);
+
+        std::printf("%10zu %16.2f %16.2f %7.2fx %18llu\n", producers, inbox / 1e6, post / 1e6, inbox / post,
+                    (unsigned long long) wakeups);
+    }
+
+    return TestUtil::GetExitCode();
+}
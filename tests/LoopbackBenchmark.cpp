@@ -0,0 +1,395 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Loopback throughput of the network layer with many connected clients (10k by default), in both directions: the
+// server broadcasting to every connection, then every client sending heartbeats. Prints the packet rate and the CPU
+// time the server process spent per packet, which is what the I/O backend (see NetworkConfig::GetIoEngine) weighs on,
+// and the writes issued per packet sent. The clients run in a child process, so the two ends of the connections don't
+// share one file descriptor limit. Meant to be run from an optimized build.
+//
+// Usage: LoopbackBenchmark [connections] [packets per connection] [port]
+
+#include "TestClient.h"
+#include "TestUtil.h"
+#include "../src/common/crypto/Security.h"
+#include "../src/common/database/Database.h"
+#include "../src/common/network/NetworkStats.h"
+#include "../src/common/network/TcpListener.h"
+#include "../src/loginserver/server/LoginOpcodes.h"
+#include "../src/loginserver/server/LoginSocket.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include <spdlog/spdlog.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// The login handlers query it; the benchmark never gets that far.
+Database database;
+
+namespace
+{
+    constexpr int32_t NETWORK_THREADS = 4;
+
+    // Commands from the server process to the client process.
+    enum Command : uint64_t
+    {
+        CONNECT,
+        RECEIVE,
+        SEND,
+        QUIT
+    };
+
+    class BenchmarkSocket : public LoginSocket
+    {
+    public:
+        using LoginSocket::LoginSocket;
+
+        static inline std::atomic<uint64_t> s_framesReceived {0};
+
+    protected:
+        bool ProcessFrame(const uint8_t* frame, size_t length) override
+        {
+            s_framesReceived.fetch_add(1, std::memory_order_relaxed);
+            return LoginSocket::ProcessFrame(frame, length);
+        }
+    };
+
+    bool WriteValue(int fd, uint64_t value)
+    {
+        return write(fd, &value, sizeof(value)) == sizeof(value);
+    }
+
+    uint64_t ReadValue(int fd)
+    {
+        uint64_t value = 0;
+        return read(fd, &value, sizeof(value)) == sizeof(value) ? value : QUIT;
+    }
+
+    // CPU time of the whole process, every thread included.
+    std::chrono::microseconds GetCpuTime()
+    {
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+               std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+    }
+
+    // Writes all of data to a non-blocking socket.
+    bool SendAll(int fd, const std::vector<uint8_t>& data)
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            const ssize_t written = write(fd, data.data() + sent, data.size() - sent);
+            if (written > 0)
+            {
+                sent += written;
+                continue;
+            }
+
+            if (written < 0 && errno != EAGAIN)
+                return false;
+
+            pollfd pfd {fd, POLLOUT, 0};
+            poll(&pfd, 1, 1000);
+        }
+
+        return true;
+    }
+
+    // Where a connection is in the stream of frames it receives. Only the sizes are read: opening every frame would
+    // make the clients, not the server, what gets measured.
+    struct ReceiveState
+    {
+        uint8_t Header[2] {};
+        size_t HeaderBytes = 0;
+        size_t Remaining = 0;
+    };
+
+    // Counts the frames received on every connection, until there are expected of them or nothing came for a while.
+    uint64_t ReceiveFrames(int epollFd, std::vector<ReceiveState>& states, const std::vector<int>& fds, uint64_t expected)
+    {
+        std::vector<epoll_event> events(1024);
+        std::vector<uint8_t> buffer(65536);
+        uint64_t frames = 0;
+
+        while (frames < expected)
+        {
+            const int count = epoll_wait(epollFd, events.data(), (int) events.size(), 10000);
+            if (count <= 0)
+                break;
+
+            for (int i = 0; i < count; i++)
+            {
+                const size_t index = events[i].data.u64;
+                ReceiveState& state = states[index];
+
+                ssize_t length;
+                while ((length = read(fds[index], buffer.data(), buffer.size())) > 0)
+                {
+                    for (ssize_t position = 0; position < length;)
+                    {
+                        if (state.HeaderBytes < sizeof(state.Header))
+                        {
+                            state.Header[state.HeaderBytes++] = buffer[position++];
+                            if (state.HeaderBytes == sizeof(state.Header))
+                                state.Remaining = (state.Header[0] | state.Header[1] << 8) - sizeof(state.Header);
+                        }
+                        else
+                        {
+                            const size_t skipped = std::min(state.Remaining, (size_t) (length - position));
+                            position += skipped;
+                            state.Remaining -= skipped;
+                        }
+
+                        if (state.HeaderBytes == sizeof(state.Header) && state.Remaining == 0)
+                        {
+                            frames++;
+                            state.HeaderBytes = 0;
+                        }
+                    }
+                }
+            }
+        }
+
+        return frames;
+    }
+
+    // The client process: connects, then receives and sends when told to, reporting back how much it did.
+    int RunClients(int commands, int results, const boost::asio::ip::tcp::endpoint& endpoint, size_t connections, size_t packets)
+    {
+        boost::asio::io_context ioContext;
+        std::vector<std::unique_ptr<TestClient>> clients;
+
+        while (true)
+        {
+            switch (ReadValue(commands))
+            {
+                case CONNECT:
+                {
+                    for (size_t i = 0; i < connections; i++)
+                    {
+                        auto client = std::make_unique<TestClient>(ioContext);
+                        if (client->Connect(endpoint))
+                            clients.push_back(std::move(client));
+                    }
+
+                    WriteValue(results, clients.size());
+                    break;
+                }
+                case RECEIVE:
+                {
+                    const uint64_t expected = ReadValue(commands);
+
+                    const int epollFd = epoll_create1(0);
+                    std::vector<ReceiveState> states(clients.size());
+                    std::vector<int> fds;
+                    for (size_t i = 0; i < clients.size(); i++)
+                    {
+                        clients[i]->GetSocket().non_blocking(true);
+                        fds.push_back(clients[i]->GetSocket().native_handle());
+
+                        epoll_event event {};
+                        event.events = EPOLLIN;
+                        event.data.u64 = i;
+                        epoll_ctl(epollFd, EPOLL_CTL_ADD, fds.back(), &event);
+                    }
+
+                    WriteValue(results, ReceiveFrames(epollFd, states, fds, expected));
+                    close(epollFd);
+                    break;
+                }
+                case SEND:
+                {
+                    // Sealed beforehand, so only the sending is timed.
+                    std::vector<std::vector<std::vector<uint8_t>>> frames(clients.size());
+                    for (size_t i = 0; i < clients.size(); i++)
+                    {
+                        for (size_t j = 0; j < packets; j++)
+                            frames[i].push_back(clients[i]->Seal(Packet(EVENT_HEART_BIT_NOT, false)));
+                    }
+
+                    WriteValue(results, 0);
+
+                    uint64_t sent = 0;
+                    for (size_t j = 0; j < packets; j++)
+                    {
+                        for (size_t i = 0; i < clients.size(); i++)
+                        {
+                            if (SendAll(clients[i]->GetSocket().native_handle(), frames[i][j]))
+                                sent++;
+                        }
+                    }
+
+                    WriteValue(results, sent);
+                    break;
+                }
+                default:
+                    return EXIT_SUCCESS;
+            }
+        }
+    }
+
+    void PrintRow(const char* direction, uint64_t packets, std::chrono::steady_clock::duration elapsed,
+                  std::chrono::microseconds cpu, double writesPerPacket)
+    {
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        std::printf("%16s %10llu %9.2f %12.1f %15.2f", direction, (unsigned long long) packets, seconds,
+                    packets / seconds / 1e3, packets ? (double) cpu.count() / packets : 0.0);
+
+        if (writesPerPacket >= 0)
+            std::printf(" %14.3f\n", writesPerPacket);
+        else
+            std::printf(" %14s\n", "-");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t connections = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000;
+    const size_t packets = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20;
+    const int32_t port = argc > 3 ? (int32_t) std::strtol(argv[3], nullptr, 10) : 19503;
+
+    spdlog::set_level(spdlog::level::warn);
+
+    // Each process holds one end of every connection.
+    rlimit limit {};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (!TEST_CHECK(limit.rlim_cur > connections + 64))
+    {
+        std::fprintf(stderr, "%zu connections need more than the %llu file descriptors allowed.\n", connections,
+                     (unsigned long long) limit.rlim_cur);
+        return TestUtil::GetExitCode();
+    }
+
+    // Every client comes from the same address and only ever sends heartbeats, without asking for them.
+    const bool configured = TestUtil::LoadConfig("LoopbackBenchmark.conf.json", R"({
+        "network_max_connections_per_ip": 0,
+        "network_accept_rate_per_ip": 0,
+        "network_handshake_timeout_ms": 0,
+        "network_heartbeat_timeout_ms": 0,
+        "network_idle_timeout_ms": 0,
+        "network_stats_interval": 0
+    })");
+
+    if (!TEST_CHECK(configured) || !TEST_CHECK(Security::InitOpenSSL()))
+        return TestUtil::GetExitCode();
+
+    const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), (uint16_t) port);
+
+    // Forked before any thread is started.
+    int commands[2];
+    int results[2];
+    if (!TEST_CHECK(pipe(commands) == 0 && pipe(results) == 0))
+        return TestUtil::GetExitCode();
+
+    const pid_t child = fork();
+    if (child == 0)
+    {
+        close(commands[1]);
+        close(results[0]);
+        _exit(RunClients(commands[0], results[1], endpoint, connections, packets));
+    }
+
+    close(commands[0]);
+    close(results[1]);
+    if (!TEST_CHECK(child > 0))
+        return TestUtil::GetExitCode();
+
+    auto listener = std::make_unique<TcpListener<BenchmarkSocket>>("", port, NETWORK_THREADS);
+
+    WriteValue(commands[1], CONNECT);
+    const uint64_t connected = ReadValue(results[0]);
+    TEST_CHECK(connected == connections);
+    TEST_CHECK(TestUtil::WaitFor([&listener, connected] () { return listener->GetConnectionCount() == connected; },
+                                 std::chrono::seconds(10)));
+
+    std::printf("%s backend, %llu connections, %d network threads, %zu packets per connection each way\n",
+                NetworkConfig::GetIoEngine(), (unsigned long long) connected, NETWORK_THREADS, packets);
+    std::printf("%16s %10s %9s %12s %15s %14s\n", "direction", "packets", "seconds", "kpackets/s", "CPU us/packet",
+                "writes/packet");
+
+    // Server to clients: broadcasts, each one sealed once per connection.
+    {
+        const uint64_t expected = connected * packets;
+        WriteValue(commands[1], RECEIVE);
+        WriteValue(commands[1], expected);
+
+        const uint64_t writesBefore = SNetworkStats.WriteCalls.load();
+        const std::chrono::microseconds cpuBefore = GetCpuTime();
+        const auto begin = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < packets; i++)
+        {
+            Packet packet(EVENT_HEART_BIT_NOT, false);
+            listener->Broadcast(packet);
+        }
+
+        const uint64_t received = ReadValue(results[0]);
+        const auto elapsed = std::chrono::steady_clock::now() - begin;
+        const std::chrono::microseconds cpu = GetCpuTime() - cpuBefore;
+        const uint64_t writes = SNetworkStats.WriteCalls.load() - writesBefore;
+
+        PrintRow("server->clients", received, elapsed, cpu, received ? (double) writes / received : 0.0);
+        TEST_CHECK(received == expected);
+    }
+
+    // Clients to server: heartbeats, decoded and handled.
+    {
+        const uint64_t expected = connected * packets;
+        WriteValue(commands[1], SEND);
+        ReadValue(results[0]);
+
+        const uint64_t framesBefore = BenchmarkSocket::s_framesReceived.load();
+        const std::chrono::microseconds cpuBefore = GetCpuTime();
+        const auto begin = std::chrono::steady_clock::now();
+
+        const bool allReceived = TestUtil::WaitFor([framesBefore, expected] ()
+        {
+            return BenchmarkSocket::s_framesReceived.load() - framesBefore >= expected;
+        }, std::chrono::seconds(60));
+
+        const auto elapsed = std::chrono::steady_clock::now() - begin;
+        const std::chrono::microseconds cpu = GetCpuTime() - cpuBefore;
+        const uint64_t sent = ReadValue(results[0]);
+
+        PrintRow("clients->server", BenchmarkSocket::s_framesReceived.load() - framesBefore, elapsed, cpu, -1);
+        TEST_CHECK(sent == expected);
+        TEST_CHECK(allReceived);
+    }
+
+    TEST_CHECK(SNetworkStats.SlowConsumerDisconnects.load() == 0);
+
+    WriteValue(commands[1], QUIT);
+    int status = 0;
+    waitpid(child, &status, 0);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+    listener->Shutdown(std::chrono::seconds(1));
+    listener.reset();
+    return TestUtil::GetExitCode();
+}
@@ -0,0 +1,443 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Fuzz target for the receive path: the bytes a client sends go through FrameDecoder, Packet::Decode and
+// PacketSchema::Decode, the way Socket::OnRead and the login handlers take them. The entry point is libFuzzer's, so the
+// file builds as is with -fsanitize=fuzzer, or against AFL++'s driver. Built with GCEMU_FUZZ_STANDALONE, as the
+// PacketFuzzer target does, it has its own main instead (see the end of the file), which replays inputs and generates
+// random ones.
+//
+// The first byte of an input picks what the rest is:
+// - bit 0 clear: the raw byte stream, received in chunks of sizes derived from the other bits. It decrypts to noise,
+//   as nothing checks the ICV yet, which reaches the payload parsing with random opcodes and lengths;
+// - bit 0 set: an opcode (2 bytes), a compression flag (1 byte) and a payload, sealed with the default Security
+//   Association and received twice in a row. This puts the payload bytes themselves in the hands of the fuzzer.
+//
+// Besides what the sanitizers catch, a sealed packet has to decode to what was sealed, and a message that decodes has
+// to encode back to the bytes it was read from. Either failing aborts.
+
+#include "../src/common/crypto/Security.h"
+#include "../src/common/network/FrameDecoder.h"
+#include "../src/common/network/Packet.h"
+#include "../src/common/network/PacketBuffer.h"
+#include "../src/common/network/PacketReader.h"
+#include "../src/common/network/PacketSchema.h"
+#include "../src/loginserver/server/LoginMessages.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <spdlog/spdlog.h>
+
+namespace
+{
+    // The server defaults (see NetworkConfig).
+    constexpr size_t RECEIVE_BUFFER_INITIAL_SIZE = 1024;
+    constexpr size_t RECEIVE_BUFFER_MAX_SIZE = 16384;
+    constexpr size_t MAX_FRAME_SIZE = 16384;
+
+    void Require(bool condition, const char* message)
+    {
+        if (!condition)
+        {
+            std::fprintf(stderr, "PacketFuzzer: %s\n", message);
+            std::abort();
+        }
+    }
+
+    const std::shared_ptr<SecurityAssociation>& GetSecurityAssociation()
+    {
+        static const std::shared_ptr<SecurityAssociation> sa = [] ()
+        {
+            // Every rejected frame is logged as an error.
+            spdlog::set_level(spdlog::level::off);
+            Require(Security::InitOpenSSL(), "OpenSSL couldn't be initialized.");
+            return Security::GetInstance().GetDefaultSecurityAssociation();
+        }();
+
+        return sa;
+    }
+
+    template <PacketSchema::Message T>
+    void DecodeMessage(const PacketReader& payload)
+    {
+        PacketReader reader = payload;
+        T message;
+        if (!PacketSchema::Decode(reader, message))
+            return;
+
+        const size_t consumed = payload.GetPayloadLength() - reader.GetReadLengthRemaining();
+        const std::vector<uint8_t> encoded = PacketSchema::Encode(message);
+        Require(encoded.size() == consumed && std::equal(encoded.begin(), encoded.end(), payload.GetPayload()),
+                "a decoded message doesn't encode back to the bytes it was read from.");
+    }
+
+    // Receives stream in chunks, as Socket::OnRead does, and decodes every frame in it. Returns the payloads of the
+    // packets that decoded.
+    std::vector<std::vector<uint8_t>> Receive(const uint8_t* stream, size_t size, uint32_t seed)
+    {
+        const std::shared_ptr<SecurityAssociation>& sa = GetSecurityAssociation();
+
+        PacketBuffer buffer;
+        buffer.SetCapacity(RECEIVE_BUFFER_INITIAL_SIZE);
+        FrameDecoder decoder(MAX_FRAME_SIZE);
+        std::vector<uint8_t> scratch;
+        std::vector<std::vector<uint8_t>> payloads;
+
+        size_t position = 0;
+        while (position < size)
+        {
+            // Anything from single bytes to whole reads, from a cheap LCG so an input always splits the same way.
+            seed = seed * 1103515245 + 12345;
+            const size_t chunk = std::min({(size_t) 1 << ((seed >> 16) % 12), size - position, buffer.WriteLengthRemaining()});
+            buffer.Write(reinterpret_cast<const char*>(stream + position), chunk);
+            position += chunk;
+
+            for (;;)
+            {
+                const uint8_t* frame;
+                size_t length;
+                const FrameDecoder::Result result = decoder.Next(buffer, scratch, frame, length);
+
+                if (result == FrameDecoder::Result::Invalid)
+                    return payloads;
+
+                if (result == FrameDecoder::Result::NeedMoreData)
+                {
+                    if (buffer.WriteLengthRemaining() == 0)
+                    {
+                        if (buffer.Capacity() >= RECEIVE_BUFFER_MAX_SIZE)
+                            return payloads;
+
+                        buffer.SetCapacity(buffer.Capacity() * 2);
+                    }
+
+                    break;
+                }
+
+                PacketReader reader;
+                if (!Packet::Decode(frame, length, sa, reader))
+                    continue;
+
+                // Whatever the opcode, as a handler reading the wrong message is what a hostile client would aim for.
+                DecodeMessage<LoginMessages::EventAcceptConnectionNot>(reader);
+                DecodeMessage<LoginMessages::EnuVerifyAccountReq>(reader);
+                DecodeMessage<LoginMessages::EnuVerifyAccountAck>(reader);
+
+                std::vector<uint8_t> payload(reader.GetPayloadLength() + 2);
+                payload[0] = reader.GetOpcode() >> 8;
+                payload[1] = reader.GetOpcode();
+                if (reader.GetPayloadLength())
+                    memcpy(payload.data() + 2, reader.GetPayload(), reader.GetPayloadLength());
+
+                payloads.push_back(std::move(payload));
+            }
+        }
+
+        return payloads;
+    }
+
+    void FuzzSealed(const uint8_t* data, size_t size, uint32_t seed)
+    {
+        if (size < 3)
+            return;
+
+        const uint16_t opcode = data[0] << 8 | data[1];
+        const bool isCompressed = data[2] & 1;
+        Packet packet(opcode, isCompressed, size - 3);
+        for (size_t i = 3; i < size; i++)
+            packet << data[i];
+
+        const std::vector<uint8_t> frame = Packet::Seal(packet.Serialize(), GetSecurityAssociation());
+        Require(!frame.empty(), "a packet couldn't be sealed.");
+
+        // A packet too large to be sent is rejected by the decoder, or by the size field overflowing.
+        if (frame.size() > MAX_FRAME_SIZE)
+            return;
+
+        std::vector<uint8_t> stream = frame;
+        stream.insert(stream.end(), frame.begin(), frame.end());
+        const std::vector<std::vector<uint8_t>> payloads = Receive(stream.data(), stream.size(), seed);
+
+        // Compressed payloads have to be valid zlib data of the announced size, which few inputs are.
+        if (isCompressed)
+            return;
+
+        Require(payloads.size() == 2, "a sealed packet didn't decode.");
+        for (const std::vector<uint8_t>& payload : payloads)
+        {
+            Require(payload.size() == size - 1 && std::equal(payload.begin(), payload.begin() + 2, data) &&
+                    std::equal(payload.begin() + 2, payload.end(), data + 3),
+                    "a sealed packet decoded to something else.");
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    const uint32_t seed = data[0] >> 1;
+    if (data[0] & 1)
+        FuzzSealed(data + 1, size - 1, seed);
+    else
+        Receive(data + 1, size - 1, seed);
+
+    return 0;
+}
+
+#ifdef GCEMU_FUZZ_STANDALONE
+
+// Replays the files given (or every file in the directories given), then runs random inputs, shaped like what the
+// target takes so most of them get past the frame decoder. This is no replacement for a coverage-guided fuzzer, but
+// runs anywhere, and under ctest. The flags are the libFuzzer ones, so the same command line works with both.
+// Whatever input makes the program abort, or a sanitizer report a bug, is written to crash-input to be replayed.
+//
+// Usage: PacketFuzzer [-runs=N] [-seed=S] [file or directory...]
+
+#include "../src/common/util/Compressor.h"
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Sanitizer reports end in an abort, so the input gets saved (see OnFatalSignal). Leaks aren't looked for: OpenSSL
+// keeps its global state until exit, and the decoders allocate nothing that outlives an input but thread buffers.
+extern "C" const char* __asan_default_options()
+{
+    return "abort_on_error=1:detect_leaks=0";
+}
+
+extern "C" const char* __ubsan_default_options()
+{
+    return "abort_on_error=1:print_stacktrace=1";
+}
+
+namespace
+{
+    std::vector<uint8_t> g_input;
+
+    void OnFatalSignal(int signal)
+    {
+        // Only async-signal-safe calls from here.
+        const int fd = open("crash-input", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            if (write(fd, g_input.data(), g_input.size()) >= 0)
+                write(STDERR_FILENO, "PacketFuzzer: input written to crash-input\n", 43);
+
+            close(fd);
+        }
+
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+    }
+
+    void Run(std::vector<uint8_t> input)
+    {
+        g_input = std::move(input);
+        LLVMFuzzerTestOneInput(g_input.data(), g_input.size());
+    }
+
+    // Fields the way PacketSchema writes them, with lengths that are sometimes wrong.
+    std::vector<uint8_t> GeneratePayload(std::mt19937& random)
+    {
+        std::vector<uint8_t> payload;
+        const size_t fields = random() % 8;
+        for (size_t i = 0; i < fields; i++)
+        {
+            const uint32_t kind = random() % 4;
+            if (kind < 3)
+            {
+                for (size_t j = 0; j < (size_t) 1 << kind; j++)
+                    payload.push_back(random());
+
+                continue;
+            }
+
+            const uint32_t length = random() % 40;
+            uint32_t announced = length;
+            if (random() % 8 == 0)
+                announced = random() % 4 ? length + random() % 4 : random();
+
+            for (size_t shift = 32; shift; shift -= 8)
+                payload.push_back(announced >> (shift - 8));
+
+            for (uint32_t j = 0; j < length; j++)
+                payload.push_back(random() % 2 ? random() % 128 : random());
+        }
+
+        return payload;
+    }
+
+    uint16_t GenerateOpcode(std::mt19937& random)
+    {
+        switch (random() % 4)
+        {
+            case 0:
+                return LoginMessages::EventAcceptConnectionNot::OPCODE;
+            case 1:
+                return LoginMessages::EnuVerifyAccountReq::OPCODE;
+            case 2:
+                return LoginMessages::EnuVerifyAccountAck::OPCODE;
+            default:
+                return random();
+        }
+    }
+
+    std::vector<uint8_t> GenerateInput(std::mt19937& random)
+    {
+        std::vector<uint8_t> input {(uint8_t) (random() << 1)};
+
+        if (random() % 2)
+        {
+            input[0] |= 1;
+            const uint16_t opcode = GenerateOpcode(random);
+            input.push_back(opcode >> 8);
+            input.push_back(opcode);
+
+            const bool isCompressed = random() % 8 == 0;
+            input.push_back(isCompressed);
+
+            std::vector<uint8_t> payload = GeneratePayload(random);
+            if (isCompressed)
+            {
+                // What Packet::Decode expects: the size once decompressed, little-endian, then the zlib data.
+                const uint32_t size = random() % 4 ? payload.size() : random();
+                for (size_t shift = 0; shift < 32; shift += 8)
+                    input.push_back(size >> shift);
+
+                payload = Compressor::CompressData(payload);
+            }
+
+            input.insert(input.end(), payload.begin(), payload.end());
+            return input;
+        }
+
+        // A few frames, sealed or made of noise, then a few bytes changed here and there.
+        const size_t frames = 1 + random() % 4;
+        for (size_t i = 0; i < frames; i++)
+        {
+            std::vector<uint8_t> frame;
+            if (random() % 2)
+            {
+                Packet packet(GenerateOpcode(random), false);
+                for (uint8_t byte : GeneratePayload(random))
+                    packet << byte;
+
+                frame = Packet::Seal(packet.Serialize(), GetSecurityAssociation());
+            }
+            else
+            {
+                frame.resize(16 + 8 * (1 + random() % 16) + AuthHandler::ICV_SIZE);
+                for (size_t j = 2; j < frame.size(); j++)
+                    frame[j] = random();
+
+                frame[0] = frame.size();
+                frame[1] = frame.size() >> 8;
+            }
+
+            input.insert(input.end(), frame.begin(), frame.end());
+        }
+
+        const size_t changes = random() % 4;
+        for (size_t i = 0; i < changes && input.size() > 1; i++)
+            input[1 + random() % (input.size() - 1)] = random();
+
+        if (random() % 8 == 0)
+            input.resize(1 + random() % input.size());
+
+        return input;
+    }
+
+    bool ReadFile(const std::filesystem::path& path, std::vector<uint8_t>& input)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        input.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t runs = 0;
+    bool runsGiven = false;
+    uint32_t seed = 1;
+    std::vector<std::filesystem::path> files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        if (argument.starts_with("-runs="))
+        {
+            runs = std::strtoull(argument.c_str() + 6, nullptr, 10);
+            runsGiven = true;
+        }
+        else if (argument.starts_with("-seed="))
+            seed = (uint32_t) std::strtoul(argument.c_str() + 6, nullptr, 10);
+        else if (argument.starts_with("-"))
+            std::fprintf(stderr, "PacketFuzzer: ignoring %s\n", argument.c_str());
+        else if (std::filesystem::is_directory(argument))
+        {
+            for (const auto& entry : std::filesystem::directory_iterator(argument))
+            {
+                if (entry.is_regular_file())
+                    files.push_back(entry.path());
+            }
+        }
+        else
+            files.push_back(argument);
+    }
+
+    // Inputs alone are only replayed, as libFuzzer does.
+    if (!runsGiven && files.empty())
+        runs = 100000;
+
+    std::signal(SIGABRT, OnFatalSignal);
+    std::signal(SIGSEGV, OnFatalSignal);
+    std::signal(SIGFPE, OnFatalSignal);
+
+    for (const std::filesystem::path& file : files)
+    {
+        std::vector<uint8_t> input;
+        if (!ReadFile(file, input))
+        {
+            std::fprintf(stderr, "PacketFuzzer: couldn't read %s\n", file.c_str());
+            return EXIT_FAILURE;
+        }
+
+        Run(std::move(input));
+    }
+
+    std::mt19937 random(seed);
+    for (uint64_t i = 0; i < runs; i++)
+        Run(GenerateInput(random));
+
+    std::printf("%zu files replayed, %llu random inputs run (seed %u)\n", files.size(), (unsigned long long) runs, seed);
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,190 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Parses the ENU_VERIFY_ACCOUNT_REQ layout (username and password hash, each behind its length) from a PacketReader
+// in the different ways ByteReader allows, from the byte by byte loop ReadString and ReadVector used to be to unchecked
+// spans, and with PacketSchema as the handler does. Prints the time per parse of each (best of a few rounds). Meant to
+// be run from an optimized build.
+//
+// Usage: ReaderBenchmark [parses per round]
+
+#include "TestUtil.h"
+#include "../src/common/network/PacketReader.h"
+#include "../src/common/network/PacketSchema.h"
+#include "../src/loginserver/server/LoginMessages.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr size_t ROUNDS = 3;
+    constexpr size_t HASH_SIZE = 32;
+
+    // Every way of parsing the payload folds what it read into this, so the reads can't be optimized away and all of
+    // them can be checked to have read the same thing.
+    uint64_t Fold(uint64_t checksum, std::span<const uint8_t> data)
+    {
+        checksum = checksum * 31 + data.size();
+        if (!data.empty())
+            checksum = checksum * 31 + data.front() + data.back();
+
+        return checksum;
+    }
+
+    uint64_t Fold(uint64_t checksum, const std::string& data)
+    {
+        return Fold(checksum, std::span<const uint8_t>((const uint8_t*) data.data(), data.size()));
+    }
+
+    // How ReadString and ReadVector read before the bulk reads, through a bounds-checked read per byte.
+    uint64_t ParsePerByte(PacketReader& reader)
+    {
+        std::string username;
+        const uint32_t usernameLength = reader.Read<uint32_t>();
+        for (uint32_t i = 0; i < usernameLength; i++)
+            username += reader.Read<char>();
+
+        std::vector<uint8_t> hash;
+        const uint32_t hashLength = reader.Read<uint32_t>();
+        for (uint32_t i = 0; i < hashLength; i++)
+            hash.push_back(reader.Read<uint8_t>());
+
+        if (reader.HasUnderflow())
+            return 0;
+
+        return Fold(Fold(0, username), hash);
+    }
+
+    uint64_t ParseOwning(PacketReader& reader)
+    {
+        const std::string username = reader.ReadString(reader.Read<uint32_t>());
+        const std::vector<uint8_t> hash = reader.ReadVector(reader.Read<uint32_t>());
+        if (reader.HasUnderflow())
+            return 0;
+
+        return Fold(Fold(0, username), hash);
+    }
+
+    uint64_t ParseSpans(PacketReader& reader)
+    {
+        const std::span<const uint8_t> username = reader.ReadSpan(reader.Read<uint32_t>());
+        const std::span<const uint8_t> hash = reader.ReadSpan(reader.Read<uint32_t>());
+        if (reader.HasUnderflow())
+            return 0;
+
+        return Fold(Fold(0, username), hash);
+    }
+
+    // With the lengths checked up front, the way a caller that knows the layout can.
+    uint64_t ParseUnchecked(PacketReader& reader)
+    {
+        if (reader.GetReadLengthRemaining() < sizeof(uint32_t))
+            return 0;
+
+        const uint32_t usernameLength = reader.ReadUnchecked<uint32_t>();
+        if (reader.GetReadLengthRemaining() < (size_t) usernameLength + sizeof(uint32_t) + HASH_SIZE)
+            return 0;
+
+        const std::span<const uint8_t> username = reader.ReadSpanUnchecked(usernameLength);
+        if (reader.ReadUnchecked<uint32_t>() != HASH_SIZE)
+            return 0;
+
+        const std::span<const uint8_t> hash = reader.ReadSpanUnchecked(HASH_SIZE);
+        return Fold(Fold(0, username), hash);
+    }
+
+    uint64_t ParseSchema(PacketReader& reader)
+    {
+        LoginMessages::EnuVerifyAccountReq request;
+        if (!PacketSchema::Decode(reader, request))
+            return 0;
+
+        return Fold(Fold(0, request.Username), request.PasswordHash);
+    }
+
+    struct Method
+    {
+        const char* Name;
+        uint64_t (*Parse)(PacketReader&);
+    };
+
+    // Returns the best time per parse, in nanoseconds, and the checksum of the last round.
+    double MeasureBest(const Method& method, const std::vector<uint8_t>& payload, uint64_t parses, uint64_t& checksum)
+    {
+        // Read back through a volatile each time, so the parse can't be hoisted out of the loop.
+        const uint8_t* volatile data = payload.data();
+
+        double best = 0;
+        for (size_t round = 0; round < ROUNDS; round++)
+        {
+            uint64_t sum = 0;
+            const auto begin = std::chrono::steady_clock::now();
+
+            for (uint64_t i = 0; i < parses; i++)
+            {
+                PacketReader reader(ENU_VERIFY_ACCOUNT_REQ, data, (uint32_t) payload.size());
+                sum += method.Parse(reader);
+            }
+
+            const double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+            if (round == 0 || elapsed < best)
+                best = elapsed;
+
+            checksum = sum;
+        }
+
+        return best / (double) parses;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const uint64_t parses = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+
+    // A username of the usual length and an MD5 hash in hexadecimal, as the client sends them.
+    LoginMessages::EnuVerifyAccountReq request;
+    request.Username = "benchmark_user_name_25chr";
+    request.PasswordHash.assign(HASH_SIZE, 'a');
+    const std::vector<uint8_t> payload = PacketSchema::Encode(request);
+
+    const Method methods[] = {
+        {"per byte (before)", ParsePerByte},
+        {"ReadString/ReadVector", ParseOwning},
+        {"ReadSpan", ParseSpans},
+        {"ReadSpanUnchecked", ParseUnchecked},
+        {"PacketSchema::Decode", ParseSchema}
+    };
+
+    std::printf("%llu parses of a %zu byte payload per round, best of %zu rounds\n", (unsigned long long) parses,
+                payload.size(), ROUNDS);
+    std::printf("%24s %12s\n", "method", "ns/parse");
+
+    const uint64_t expected = Fold(Fold(0, request.Username), request.PasswordHash) * parses;
+    for (const Method& method : methods)
+    {
+        uint64_t checksum = 0;
+        const double nanoseconds = MeasureBest(method, payload, parses, checksum);
+        std::printf("%24s %12.2f\n", method.Name, nanoseconds);
+
+        TEST_CHECK(checksum == expected);
+    }
+
+    return TestUtil::GetExitCode();
+}
@@ -0,0 +1,303 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Cross-thread send stress, meant to run under ThreadSanitizer (see the SendStressTsan target). Sender threads call
+// LoginSocket::SendPacket, TcpListener::Broadcast (to everyone and to a subset) and Socket::Close on live connections,
+// while clients keep connecting and hanging up and the listener keeps migrating the connections between its threads.
+// Any race is reported by TSan, which makes the program fail; the end checks are the same as ConnectionSoak's.
+//
+// Usage: SendStress [seconds] [port]
+
+#include "TestUtil.h"
+#include "../src/common/crypto/Security.h"
+#include "../src/common/database/Database.h"
+#include "../src/common/network/NetworkStats.h"
+#include "../src/common/network/TcpListener.h"
+#include "../src/loginserver/server/LoginOpcodes.h"
+#include "../src/loginserver/server/LoginSocket.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <spdlog/spdlog.h>
+
+// The login handlers query it; the stress never gets that far.
+Database database;
+
+namespace
+{
+    constexpr int32_t NETWORK_THREADS = 4;
+    constexpr size_t SENDER_THREADS = 4;
+    constexpr size_t CLIENT_THREADS = 4;
+    constexpr size_t CONNECTIONS_PER_CLIENT = 16;
+
+    // Every opened connection, so the senders can reach them from their own threads. The weak references still hold
+    // the memory of the sockets (see PoolAllocator), until they are cleared.
+    class Registry
+    {
+    public:
+        void Add(const std::shared_ptr<LoginSocket>& socket)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sockets.push_back(socket);
+        }
+
+        // The connections still alive, forgetting the others.
+        std::vector<std::shared_ptr<LoginSocket>> Snapshot()
+        {
+            std::vector<std::shared_ptr<LoginSocket>> sockets;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::erase_if(m_sockets, [&sockets] (const std::weak_ptr<LoginSocket>& weak)
+            {
+                std::shared_ptr<LoginSocket> socket = weak.lock();
+                if (!socket || socket->IsClosed())
+                    return true;
+
+                sockets.push_back(std::move(socket));
+                return false;
+            });
+
+            return sockets;
+        }
+
+        void Clear()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sockets.clear();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::vector<std::weak_ptr<LoginSocket>> m_sockets;
+    };
+
+    Registry registry;
+
+    class StressSocket : public LoginSocket
+    {
+    public:
+        using LoginSocket::LoginSocket;
+
+        bool Open() override
+        {
+            if (!LoginSocket::Open())
+                return false;
+
+            registry.Add(shared<LoginSocket>());
+            return true;
+        }
+    };
+
+    // Keeps its connections open, reading whatever the server sends so its send queues drain, and replaces one of them
+    // now and then, hanging up with a FIN or a reset.
+    void RunClient(const boost::asio::ip::tcp::endpoint& endpoint, const std::atomic<bool>& stop, std::atomic<uint64_t>& failed, uint32_t seed)
+    {
+        boost::asio::io_context ioContext;
+        std::mt19937 random(seed);
+        std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> sockets(CONNECTIONS_PER_CLIENT);
+        uint8_t buffer[4096];
+
+        while (!stop)
+        {
+            for (auto& socket : sockets)
+            {
+                boost::system::error_code ec;
+                if (socket && random() % 256 == 0)
+                {
+                    if (random() % 2)
+                        socket->set_option(boost::asio::socket_base::linger(true, 0), ec);
+
+                    socket->close(ec);
+                    socket.reset();
+                }
+
+                if (!socket)
+                {
+                    socket = std::make_unique<boost::asio::ip::tcp::socket>(ioContext);
+                    socket->connect(endpoint, ec);
+                    if (!ec)
+                        socket->non_blocking(true, ec);
+
+                    if (ec)
+                    {
+                        failed++;
+                        socket.reset();
+                    }
+
+                    continue;
+                }
+
+                // A connection the server closed (see the senders) reads as an EOF or a reset, and is replaced.
+                size_t length;
+                do
+                    length = socket->read_some(boost::asio::buffer(buffer), ec);
+                while (!ec && length);
+
+                if (ec != boost::asio::error::would_block)
+                    socket.reset();
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void RunSender(TcpListener<StressSocket>& listener, const std::atomic<bool>& stop, std::atomic<uint64_t>& sent, uint32_t seed)
+    {
+        std::mt19937 random(seed);
+
+        while (!stop)
+        {
+            std::vector<std::shared_ptr<LoginSocket>> sockets = registry.Snapshot();
+            if (sockets.empty())
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            Packet packet(EVENT_HEART_BIT_NOT, false);
+            packet << (uint32_t) random();
+
+            // Non-critical, so a slow client has its packets dropped rather than being disconnected. Broadcasts are the
+            // rarest, as they seal the packet once per connection.
+            switch (random() % 32)
+            {
+                case 0:
+                    listener.Broadcast(packet, false);
+                    break;
+                case 1:
+                {
+                    std::vector<std::shared_ptr<StressSocket>> recipients;
+                    for (const std::shared_ptr<LoginSocket>& socket : sockets)
+                    {
+                        if (random() % 2)
+                            recipients.push_back(std::static_pointer_cast<StressSocket>(socket));
+                    }
+
+                    TcpListener<StressSocket>::Broadcast(packet, recipients, false);
+                    break;
+                }
+                case 2:
+                    if (random() % 32 == 0)
+                        sockets[random() % sockets.size()]->Close();
+                    break;
+                default:
+                    sockets[random() % sockets.size()]->SendPacket(packet, false);
+                    break;
+            }
+
+            sent++;
+
+            // Paced so the network threads keep up: a broadcast seals the packet once per connection, and a backlog of
+            // them would only leave the connections too busy to migrate.
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const int64_t seconds = argc > 1 ? std::strtoll(argv[1], nullptr, 10) : 10;
+    const int32_t port = argc > 2 ? (int32_t) std::strtol(argv[2], nullptr, 10) : 19502;
+
+    spdlog::set_level(spdlog::level::warn);
+
+    // Every client comes from the same address, so the per-IP limits are off.
+    const bool configured = TestUtil::LoadConfig("SendStress.conf.json", R"({
+        "network_max_connections_per_ip": 0,
+        "network_accept_rate_per_ip": 0,
+        "network_sweep_interval_ms": 10,
+        "network_migration_threshold": 1,
+        "network_migration_batch": 64,
+        "network_send_queue_overflow": "drop",
+        "network_stats_interval": 0
+    })");
+
+    if (!TEST_CHECK(configured) || !TEST_CHECK(Security::InitOpenSSL()))
+        return TestUtil::GetExitCode();
+
+    const size_t baseSecurityAssociations = Security::GetInstance().GetSecurityAssociationCount();
+    auto listener = std::make_unique<TcpListener<StressSocket>>("", port, NETWORK_THREADS);
+
+    const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), (uint16_t) port);
+    std::atomic<bool> stopSenders {false};
+    std::atomic<bool> stopClients {false};
+    std::atomic<uint64_t> sent {0};
+    std::atomic<uint64_t> failed {0};
+
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < CLIENT_THREADS; i++)
+        clients.emplace_back(RunClient, std::cref(endpoint), std::cref(stopClients), std::ref(failed), (uint32_t) i);
+
+    std::vector<std::thread> senders;
+    for (size_t i = 0; i < SENDER_THREADS; i++)
+        senders.emplace_back(RunSender, std::ref(*listener), std::cref(stopSenders), std::ref(sent), (uint32_t) (100 + i));
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+    stopSenders = true;
+    for (std::thread& sender : senders)
+        sender.join();
+
+    stopClients = true;
+    for (std::thread& client : clients)
+        client.join();
+
+    const uint64_t migrated = SNetworkStats.SocketsMigrated.load();
+    std::printf("%llu sends, %llu sockets migrated, %llu failed connects\n", (unsigned long long) sent.load(),
+                (unsigned long long) migrated, (unsigned long long) failed.load());
+
+    TEST_CHECK(sent > 0);
+    TEST_CHECK(migrated > 0);
+    TEST_CHECK(failed == 0);
+
+    const bool tableEmpty = TestUtil::WaitFor([&listener] () { return listener->GetConnectionCount() == 0; },
+                                              std::chrono::seconds(10));
+    const bool spisReleased = TestUtil::WaitFor([baseSecurityAssociations] ()
+    {
+        return Security::GetInstance().GetSecurityAssociationCount() == baseSecurityAssociations;
+    }, std::chrono::seconds(10));
+
+    std::printf("%zu connections left, %zu Security Associations left besides the default one\n",
+                listener->GetConnectionCount(),
+                Security::GetInstance().GetSecurityAssociationCount() - baseSecurityAssociations);
+    TEST_CHECK(tableEmpty);
+    TEST_CHECK(spisReleased);
+
+    // The pending accept holds a pooled socket until the listener stops accepting, and the registry still holds the
+    // memory of the sockets it saw.
+    listener->Shutdown(std::chrono::seconds(1));
+    registry.Clear();
+
+    size_t sockets = 0;
+    size_t buffers = 0;
+    const bool poolsEmpty = TestUtil::WaitFor([&listener, &sockets, &buffers] ()
+    {
+        listener->GetPoolUsage(sockets, buffers);
+        return sockets == 0 && buffers == 0;
+    }, std::chrono::seconds(10));
+
+    std::printf("%zu pooled sockets and %zu pooled buffers still in use\n", sockets, buffers);
+    TEST_CHECK(poolsEmpty);
+
+    listener.reset();
+    return TestUtil::GetExitCode();
+}
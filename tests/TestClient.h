@@ -0,0 +1,203 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_TESTCLIENT_H
+#define GCEMU_TESTCLIENT_H
+
+#include "../src/common/crypto/AuthHandler.h"
+#include "../src/common/crypto/CryptoHandler.h"
+#include "../src/common/network/Packet.h"
+#include "../src/common/network/PacketReader.h"
+#include "../src/common/network/PacketSchema.h"
+#include "../src/loginserver/server/LoginMessages.h"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <boost/asio.hpp>
+
+// Blocking client for the tests, speaking to a LoginSocket the way the game client does: Connect takes the Security
+// Association the server sends in EVENT_ACCEPT_CONNECTION_NOT, and every packet after that is sealed and opened with
+// it. The ICV of received frames is checked, which the server doesn't do yet (see Packet::Decode). Reads give up after
+// READ_TIMEOUT, so a packet the server never sends fails the test rather than hanging it.
+class TestClient
+{
+public:
+    // Frame header: size, SPI, sequence number and IV.
+    static constexpr size_t HEADER_SIZE = 16;
+
+    static constexpr std::chrono::seconds READ_TIMEOUT {10};
+
+    explicit TestClient(boost::asio::io_context& ioContext) : m_ioContext(ioContext), m_socket(ioContext)
+    {
+    }
+
+    bool Connect(const boost::asio::ip::tcp::endpoint& endpoint)
+    {
+        boost::system::error_code ec;
+        m_socket.connect(endpoint, ec);
+        if (ec)
+            return false;
+
+        m_socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+
+        // The accept packet is sealed with the keys every client starts with.
+        m_authenticationKey = {0xC0, 0xD3, 0xBD, 0xC3, 0xB7, 0xCE, 0xB8, 0xB8};
+        m_encryptionKey = {0xC7, 0xD8, 0xC4, 0xBF, 0xB5, 0xE9, 0xC0, 0xFD};
+
+        uint16_t opcode;
+        std::vector<uint8_t> payload;
+        if (!ReadPacket(opcode, payload) || opcode != LoginMessages::EventAcceptConnectionNot::OPCODE)
+            return false;
+
+        LoginMessages::EventAcceptConnectionNot message;
+        PacketReader reader(opcode, payload.data(), (uint32_t) payload.size());
+        if (!PacketSchema::Decode(reader, message))
+            return false;
+
+        m_spi = message.Spi;
+        m_authenticationKey = message.SecurityAssociation.AuthenticationKey;
+        m_encryptionKey = message.SecurityAssociation.EncryptionKey;
+        return true;
+    }
+
+    bool ReadFrame(std::vector<uint8_t>& frame)
+    {
+        uint8_t size[2];
+        if (!Read(size, sizeof(size)))
+            return false;
+
+        frame.resize(size[0] | size[1] << 8);
+        if (frame.size() < HEADER_SIZE + AuthHandler::ICV_SIZE)
+            return false;
+
+        memcpy(frame.data(), size, sizeof(size));
+        return Read(frame.data() + sizeof(size), frame.size() - sizeof(size));
+    }
+
+    bool ReadPacket(uint16_t& opcode, std::vector<uint8_t>& payload)
+    {
+        std::vector<uint8_t> frame;
+        return ReadFrame(frame) && Open(frame, opcode, payload);
+    }
+
+    // Checks the ICV of a received frame and decrypts it. Compressed packets aren't supported.
+    bool Open(const std::vector<uint8_t>& frame, uint16_t& opcode, std::vector<uint8_t>& payload) const
+    {
+        if (frame.size() < HEADER_SIZE + AuthHandler::ICV_SIZE + 8)
+            return false;
+
+        const size_t encryptedLength = frame.size() - HEADER_SIZE - AuthHandler::ICV_SIZE;
+        if (encryptedLength % 8)
+            return false;
+
+        uint8_t icv[AuthHandler::ICV_SIZE];
+        AuthHandler authHandler(m_authenticationKey);
+        if (!authHandler.GetICV(frame.data() + 2, frame.size() - 2 - AuthHandler::ICV_SIZE, icv) ||
+            memcmp(icv, frame.data() + frame.size() - AuthHandler::ICV_SIZE, AuthHandler::ICV_SIZE) != 0)
+            return false;
+
+        std::vector<uint8_t> plaintext(encryptedLength);
+        CryptoHandler cryptoHandler(m_encryptionKey);
+        if (!cryptoHandler.DecryptData(frame.data() + HEADER_SIZE, encryptedLength, frame.data() + 8, plaintext.data()))
+            return false;
+
+        opcode = plaintext[0] << 8 | plaintext[1];
+        const uint32_t payloadLength = plaintext[2] << 24 | plaintext[3] << 16 | plaintext[4] << 8 | plaintext[5];
+        if (plaintext[6] || payloadLength > encryptedLength - 7)
+            return false;
+
+        payload.assign(plaintext.begin() + 7, plaintext.begin() + 7 + payloadLength);
+        return true;
+    }
+
+    // The frame the game client would send for packet.
+    std::vector<uint8_t> Seal(const Packet& packet)
+    {
+        const std::vector<uint8_t> plaintext = packet.Serialize();
+        const size_t encryptedLength = CryptoHandler::GetPaddedLength(plaintext.size());
+        std::vector<uint8_t> frame(HEADER_SIZE + encryptedLength + AuthHandler::ICV_SIZE);
+
+        const uint16_t size = frame.size();
+        const uint32_t sequenceNumber = ++m_sequenceNumber;
+        memcpy(frame.data(), &size, sizeof(size));
+        memcpy(frame.data() + 2, &m_spi, sizeof(m_spi));
+        memcpy(frame.data() + 4, &sequenceNumber, sizeof(sequenceNumber));
+        memset(frame.data() + 8, (uint8_t) sequenceNumber, 8);
+
+        uint8_t* encrypted = frame.data() + HEADER_SIZE;
+        memcpy(encrypted, plaintext.data(), plaintext.size());
+        CryptoHandler::PadData(encrypted, plaintext.size(), encryptedLength);
+        CryptoHandler(m_encryptionKey).EncryptData(encrypted, encryptedLength, frame.data() + 8, encrypted);
+
+        AuthHandler(m_authenticationKey).GetICV(frame.data() + 2, frame.size() - 2 - AuthHandler::ICV_SIZE,
+                                                frame.data() + frame.size() - AuthHandler::ICV_SIZE);
+        return frame;
+    }
+
+    bool Send(const std::vector<uint8_t>& data)
+    {
+        boost::system::error_code ec;
+        boost::asio::write(m_socket, boost::asio::buffer(data), ec);
+        return !ec;
+    }
+
+    bool SendPacket(const Packet& packet)
+    {
+        return Send(Seal(packet));
+    }
+
+    boost::asio::ip::tcp::socket& GetSocket()
+    {
+        return m_socket;
+    }
+
+    uint16_t GetSpi() const
+    {
+        return m_spi;
+    }
+
+private:
+    // Reads exactly length bytes, within READ_TIMEOUT.
+    bool Read(uint8_t* data, size_t length)
+    {
+        boost::system::error_code ec;
+        bool done = false;
+        boost::asio::async_read(m_socket, boost::asio::buffer(data, length),
+                                [&ec, &done] (const boost::system::error_code& error, size_t) { ec = error; done = true; });
+
+        // Runs until the read completes, which leaves the context out of work, or the timeout expires.
+        m_ioContext.restart();
+        m_ioContext.run_for(READ_TIMEOUT);
+        if (!done)
+        {
+            m_socket.cancel();
+            m_ioContext.restart();
+            m_ioContext.run();
+            return false;
+        }
+
+        return !ec;
+    }
+
+    boost::asio::io_context& m_ioContext;
+    boost::asio::ip::tcp::socket m_socket;
+    uint16_t m_spi = 0;
+    uint32_t m_sequenceNumber = 0;
+    std::vector<uint8_t> m_authenticationKey;
+    std::vector<uint8_t> m_encryptionKey;
+};
+
+#endif //GCEMU_TESTCLIENT_H
@@ -0,0 +1,91 @@
+// This file is part of the GCEmu Project.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GCEMU_TESTUTIL_H
+#define GCEMU_TESTUTIL_H
+
+#include "../src/common/config/ConfigHandler.h"
+#include "../src/common/network/AdmissionControl.h"
+#include "../src/common/network/NetworkConfig.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+
+// Checks for the test programs. A failed check is reported on stderr and makes the program exit with a non-zero
+// code once it is done, which is all ctest looks at.
+#define TEST_CHECK(condition) TestUtil::Check((condition), #condition, __FILE__, __LINE__)
+
+namespace TestUtil
+{
+    inline int g_failures = 0;
+
+    inline bool Check(bool passed, const char* condition, const char* file, int line)
+    {
+        if (!passed)
+        {
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+            g_failures++;
+        }
+
+        return passed;
+    }
+
+    inline int GetExitCode()
+    {
+        if (g_failures)
+            std::fprintf(stderr, "%d checks failed.\n", g_failures);
+
+        return g_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // Writes a config file holding the given JSON object to the working directory and loads the settings the network
+    // layer reads from it, as the server does at startup.
+    inline bool LoadConfig(const std::string& filename, const std::string& json)
+    {
+        {
+            std::ofstream file(filename, std::ios::trunc);
+            file << json;
+            if (!file)
+                return false;
+        }
+
+        if (!SConfigHandler.SetConfigFile(filename) || !SNetworkConfig.Load())
+            return false;
+
+        SAdmissionControl.Initialize();
+        return true;
+    }
+
+    // Polls the condition until it holds or the timeout expires, for state other threads settle asynchronously.
+    template <typename Condition>
+    bool WaitFor(Condition condition, std::chrono::milliseconds timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!condition())
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+                return false;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+
+        return true;
+    }
+}
+
+#endif //GCEMU_TESTUTIL_H